@@ -3,6 +3,8 @@
 #include "interval.hpp"
 #include "vec3.hpp"
 
+#include <algorithm>
+
 #pragma region AABB declaration
 class aabb {
 
@@ -43,29 +45,36 @@ public:
         return x;
     }
 
-    bool hit(const ray& r, interval ray_t) const {
-        const point3& ray_origin{ r.origin() };
-        const vec3& ray_dir{ r.direction() };
-
-        for (int axis{}; axis < 3; ++axis) {
-            const interval& ax{ axis_interval(axis) };
-            const float adinv{ 1.0f / ray_dir[axis] }; // maybe switch to float to be consistent
-
-            auto t0{ (ax.min - ray_origin[axis]) * adinv };
-            auto t1{ (ax.max - ray_origin[axis]) * adinv };
-
-            if (t0 < t1) {
-                if (t0 > ray_t.min) ray_t.min = t0;
-                if (t1 < ray_t.max) ray_t.max = t1;
-            } else {
-                if (t1 > ray_t.min) ray_t.min = t1;
-                if (t0 < ray_t.max) ray_t.max = t0;
-            }
-
-            if (ray_t.max <= ray_t.min)
-                return false;
-        }
-        return true;
+    bool hit(const ray& r, interval ray_t) const { return hit(traversal_ray{ r }, ray_t); }
+
+    // Slab test on the precomputed reciprocal direction, the sign bits pick the near and far plane
+    // per axis so there is no swap or early out. NaNs from 0 * inf land in the second argument of
+    // std::max / std::min and are dropped, so a ray lying in a slab plane is not rejected.
+    bool hit(const traversal_ray& r, interval ray_t) const {
+        const point3& ray_origin{ r.origin };
+        const vec3& inv_dir{ r.inv_dir };
+
+        const float near_x{ ((r.dir_is_neg[0] ? x.max : x.min) - ray_origin.x()) * inv_dir.x() };
+        const float far_x{ ((r.dir_is_neg[0] ? x.min : x.max) - ray_origin.x()) * inv_dir.x() };
+        const float near_y{ ((r.dir_is_neg[1] ? y.max : y.min) - ray_origin.y()) * inv_dir.y() };
+        const float far_y{ ((r.dir_is_neg[1] ? y.min : y.max) - ray_origin.y()) * inv_dir.y() };
+        const float near_z{ ((r.dir_is_neg[2] ? z.max : z.min) - ray_origin.z()) * inv_dir.z() };
+        const float far_z{ ((r.dir_is_neg[2] ? z.min : z.max) - ray_origin.z()) * inv_dir.z() };
+
+        const float t_enter{ std::max(std::max(std::max(ray_t.min, near_x), near_y), near_z) };
+        const float t_exit{ std::min(std::min(std::min(ray_t.max, far_x), far_y), far_z) };
+
+        return t_enter <= t_exit;
+    }
+
+    point3 centroid() const {
+        return point3{ 0.5f * (x.min + x.max), 0.5f * (y.min + y.max), 0.5f * (z.min + z.max) };
+    }
+
+    float surface_area() const {
+        if (x.size() < 0.f || y.size() < 0.f || z.size() < 0.f)
+            return 0.f;
+        return 2.f * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
     }
 
     int longest_axis() const {
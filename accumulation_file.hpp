@@ -0,0 +1,229 @@
+#pragma once
+
+#include "color.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#pragma region accumulation
+// Raw HDR state of a render: per pixel sums and sample counts plus the seeds that produced them.
+// Samples are keyed by (seed, pixel, sample index) and a render always continues a pixel at its current count,
+// so these are all a renderer needs to carry on where another one stopped.
+struct accumulation {
+    int width{};
+    int height{};
+    int samples_per_pixel{}; // the camera's target, the sum of the parts' for a merge
+    int max_depth{};
+    uint32_t sampler{};      // camera sampler_kind
+    std::string scene{};
+    std::vector<uint32_t> seeds{}; // every seed that contributed, merges refuse to count a seed twice
+    std::vector<pixel_accumulator> pixels{}; // row major
+};
+
+// Empty when a and b render the same image the same way, otherwise what differs. Merged parts may each have
+// their own samples_per_pixel, a resumed render has to keep the one it was started with.
+std::string accumulation_mismatch(const accumulation& a, const accumulation& b, bool compare_samples_per_pixel) {
+    std::string mismatch{};
+    const auto differs{ [&](const std::string& what, const std::string& value_a, const std::string& value_b) {
+        if (value_a != value_b)
+            mismatch += (mismatch.empty() ? "" : ", ") + what + " " + value_a + " vs " + value_b;
+    } };
+
+    differs("scene", a.scene, b.scene);
+    differs("size", std::to_string(a.width) + "x" + std::to_string(a.height), std::to_string(b.width) + "x" + std::to_string(b.height));
+    if (compare_samples_per_pixel)
+        differs("samples_per_pixel", std::to_string(a.samples_per_pixel), std::to_string(b.samples_per_pixel));
+    differs("max_depth", std::to_string(a.max_depth), std::to_string(b.max_depth));
+    differs("sampler", std::to_string(a.sampler), std::to_string(b.sampler));
+    return mismatch;
+}
+#pragma endregion
+
+#pragma region accumulation file
+// Layout, native byte order:
+//   char[8] magic, uint32 version, int32 width, int32 height, int32 samples_per_pixel, int32 max_depth,
+//   uint32 sampler, uint32 scene length, char scene[scene length], uint32 seed count, uint32 seeds[seed count],
+//   then per pixel (row major) float sum[3], float luminance_squared_sum, int32 samples.
+constexpr char accumulation_magic[8]{ 'R', 'T', 'A', 'C', 'C', 'U', 'M', '\0' };
+constexpr uint32_t accumulation_version{ 2 };
+constexpr uint32_t max_scene_name_length{ 256 };
+
+// Written to a temporary file first and renamed over the old one, a crash while writing leaves the previous
+// checkpoint intact.
+bool save_accumulation(const std::string& filename, const accumulation& acc) {
+    const std::string temporary{ filename + ".tmp" };
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        if (!file) {
+            std::cerr << "Cannot open file: " << temporary << std::endl;
+            return false;
+        }
+
+        const uint32_t scene_length{ static_cast<uint32_t>(std::min<size_t>(acc.scene.size(), max_scene_name_length)) };
+        const uint32_t seed_count{ static_cast<uint32_t>(acc.seeds.size()) };
+        file.write(accumulation_magic, sizeof(accumulation_magic));
+        file.write(reinterpret_cast<const char*>(&accumulation_version), sizeof(accumulation_version));
+        file.write(reinterpret_cast<const char*>(&acc.width), sizeof(acc.width));
+        file.write(reinterpret_cast<const char*>(&acc.height), sizeof(acc.height));
+        file.write(reinterpret_cast<const char*>(&acc.samples_per_pixel), sizeof(acc.samples_per_pixel));
+        file.write(reinterpret_cast<const char*>(&acc.max_depth), sizeof(acc.max_depth));
+        file.write(reinterpret_cast<const char*>(&acc.sampler), sizeof(acc.sampler));
+        file.write(reinterpret_cast<const char*>(&scene_length), sizeof(scene_length));
+        file.write(acc.scene.data(), scene_length);
+        file.write(reinterpret_cast<const char*>(&seed_count), sizeof(seed_count));
+        file.write(reinterpret_cast<const char*>(acc.seeds.data()), seed_count * sizeof(uint32_t));
+
+        // Packed by hand, pixel_accumulator's layout is not part of the format
+        std::vector<unsigned char> buffer(acc.pixels.size() * 5 * sizeof(float));
+        unsigned char* out{ buffer.data() };
+        for (const pixel_accumulator& pixel : acc.pixels) {
+            const float values[4]{ pixel.sum.x(), pixel.sum.y(), pixel.sum.z(), pixel.luminance_squared_sum };
+            std::memcpy(out, values, sizeof(values));
+            std::memcpy(out + sizeof(values), &pixel.samples, sizeof(int32_t));
+            out += sizeof(values) + sizeof(int32_t);
+        }
+        file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+
+        if (!file) {
+            std::cerr << "Failed writing file: " << temporary << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, filename, error);
+    if (error) {
+        std::cerr << "Cannot replace " << filename << ": " << error.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool load_accumulation(const std::string& filename, accumulation& acc) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open file: " << filename << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(accumulation_magic)]{};
+    uint32_t version{};
+    uint32_t scene_length{};
+    uint32_t seed_count{};
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!file || std::memcmp(magic, accumulation_magic, sizeof(magic)) != 0) {
+        std::cerr << "Not an accumulation file: " << filename << std::endl;
+        return false;
+    }
+    if (version != accumulation_version) {
+        std::cerr << "Accumulation file " << filename << " is version " << version << ", expected "
+            << accumulation_version << std::endl;
+        return false;
+    }
+
+    file.read(reinterpret_cast<char*>(&acc.width), sizeof(acc.width));
+    file.read(reinterpret_cast<char*>(&acc.height), sizeof(acc.height));
+    file.read(reinterpret_cast<char*>(&acc.samples_per_pixel), sizeof(acc.samples_per_pixel));
+    file.read(reinterpret_cast<char*>(&acc.max_depth), sizeof(acc.max_depth));
+    file.read(reinterpret_cast<char*>(&acc.sampler), sizeof(acc.sampler));
+    file.read(reinterpret_cast<char*>(&scene_length), sizeof(scene_length));
+    if (!file || scene_length > max_scene_name_length) {
+        std::cerr << "Not an accumulation file: " << filename << std::endl;
+        return false;
+    }
+    acc.scene.resize(scene_length);
+    file.read(acc.scene.data(), scene_length);
+    file.read(reinterpret_cast<char*>(&seed_count), sizeof(seed_count));
+
+    if (!file || acc.width <= 0 || acc.height <= 0 || seed_count > (1u << 20)) {
+        std::cerr << "Not an accumulation file: " << filename << std::endl;
+        return false;
+    }
+
+    acc.seeds.resize(seed_count);
+    file.read(reinterpret_cast<char*>(acc.seeds.data()), seed_count * sizeof(uint32_t));
+
+    acc.pixels.resize(static_cast<size_t>(acc.width) * acc.height);
+    std::vector<unsigned char> buffer(acc.pixels.size() * 5 * sizeof(float));
+    file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    if (!file) {
+        std::cerr << "Truncated accumulation file: " << filename << std::endl;
+        return false;
+    }
+
+    const unsigned char* in{ buffer.data() };
+    for (pixel_accumulator& pixel : acc.pixels) {
+        float values[4];
+        std::memcpy(values, in, sizeof(values));
+        std::memcpy(&pixel.samples, in + sizeof(values), sizeof(int32_t));
+        pixel.sum = color(values[0], values[1], values[2]);
+        pixel.luminance_squared_sum = values[3];
+        in += sizeof(values) + sizeof(int32_t);
+    }
+    return true;
+}
+#pragma endregion
+
+#pragma region merge
+// Adds other's samples to acc. Renders sharing a seed drew the same random numbers for their first samples,
+// summing them would count those samples twice, so that is refused.
+bool merge_accumulation(accumulation& acc, const accumulation& other) {
+    const std::string mismatch{ accumulation_mismatch(acc, other, false) };
+    if (!mismatch.empty()) {
+        std::cerr << "Cannot merge renders of different setups: " << mismatch << std::endl;
+        return false;
+    }
+
+    for (uint32_t seed : other.seeds) {
+        if (std::find(acc.seeds.begin(), acc.seeds.end(), seed) != acc.seeds.end()) {
+            std::cerr << "Both renders used seed " << seed << ", render the parts with different random_seed" << std::endl;
+            return false;
+        }
+    }
+
+    acc.seeds.insert(acc.seeds.end(), other.seeds.begin(), other.seeds.end());
+    acc.samples_per_pixel += other.samples_per_pixel;
+    for (size_t i = 0; i < acc.pixels.size(); ++i) {
+        acc.pixels[i].sum += other.pixels[i].sum;
+        acc.pixels[i].luminance_squared_sum += other.pixels[i].luminance_squared_sum;
+        acc.pixels[i].samples += other.pixels[i].samples;
+    }
+    return true;
+}
+
+// Combines independently seeded renders of one frame into output (an accumulation file that can be resumed
+// or merged again) and writes the image to image_filename.
+bool merge_accumulation_files(const std::vector<std::string>& inputs, const std::string& output, const std::string& image_filename) {
+    if (inputs.empty())
+        return false;
+
+    accumulation merged;
+    if (!load_accumulation(inputs.front(), merged))
+        return false;
+
+    for (size_t i = 1; i < inputs.size(); ++i) {
+        accumulation part;
+        if (!load_accumulation(inputs[i], part) || !merge_accumulation(merged, part))
+            return false;
+    }
+
+    if (!save_accumulation(output, merged))
+        return false;
+
+    uint64_t total_samples{ 0 };
+    for (const pixel_accumulator& pixel : merged.pixels)
+        total_samples += pixel.samples;
+    std::clog << "Merged " << inputs.size() << " renders, " << total_samples / merged.pixels.size()
+        << " samples per pixel on average\n";
+
+    save_ppm_binary(image_filename, merged.pixels, merged.width, merged.height);
+    return true;
+}
+#pragma endregion
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "rtweekend.hpp"
+#include "vec3.hpp"
+
+#include <cmath>
+
+#pragma region affine transform
+// Row major 3x4 matrix, the left 3x3 block is the linear part and the last column the translation.
+// Composition reads right to left: (translation(t) * scaling(s)).transform_point(p) scales first.
+struct affine3 {
+    float m[3][4]{
+        { 1.f, 0.f, 0.f, 0.f },
+        { 0.f, 1.f, 0.f, 0.f },
+        { 0.f, 0.f, 1.f, 0.f },
+    };
+
+    static affine3 identity() { return affine3{}; }
+
+    static affine3 translation(const vec3& offset) {
+        affine3 result{};
+        result.m[0][3] = offset.x();
+        result.m[1][3] = offset.y();
+        result.m[2][3] = offset.z();
+        return result;
+    }
+
+    static affine3 scaling(const vec3& scale) {
+        affine3 result{};
+        result.m[0][0] = scale.x();
+        result.m[1][1] = scale.y();
+        result.m[2][2] = scale.z();
+        return result;
+    }
+
+    // Right handed rotation about an arbitrary axis through the origin (Rodrigues)
+    static affine3 rotation(const vec3& axis, float degrees) {
+        const vec3 a{ unit_vector(axis) };
+        const float radians{ degrees_to_radians(degrees) };
+        const float s{ std::sin(radians) };
+        const float c{ std::cos(radians) };
+        const float t{ 1.f - c };
+
+        affine3 result{};
+        result.m[0][0] = t * a.x() * a.x() + c;
+        result.m[0][1] = t * a.x() * a.y() - s * a.z();
+        result.m[0][2] = t * a.x() * a.z() + s * a.y();
+        result.m[1][0] = t * a.x() * a.y() + s * a.z();
+        result.m[1][1] = t * a.y() * a.y() + c;
+        result.m[1][2] = t * a.y() * a.z() - s * a.x();
+        result.m[2][0] = t * a.x() * a.z() - s * a.y();
+        result.m[2][1] = t * a.y() * a.z() + s * a.x();
+        result.m[2][2] = t * a.z() * a.z() + c;
+        return result;
+    }
+
+    // Same as rotation(vec3(0,1,0), degrees) with exact zeros: positive angles turn +x towards -z
+    static affine3 rotation_y(float degrees) {
+        const float radians{ degrees_to_radians(degrees) };
+        const float sin_theta{ std::sin(radians) };
+        const float cos_theta{ std::cos(radians) };
+
+        affine3 result{};
+        result.m[0][0] = cos_theta;
+        result.m[0][2] = sin_theta;
+        result.m[2][0] = -sin_theta;
+        result.m[2][2] = cos_theta;
+        return result;
+    }
+
+    affine3 operator*(const affine3& rhs) const {
+        affine3 result{};
+        for (int row{}; row < 3; ++row) {
+            for (int col{}; col < 4; ++col) {
+                float sum{ col == 3 ? m[row][3] : 0.f };
+                for (int k{}; k < 3; ++k)
+                    sum += m[row][k] * rhs.m[k][col];
+                result.m[row][col] = sum;
+            }
+        }
+        return result;
+    }
+
+    __forceinline point3 transform_point(const point3& p) const {
+        return point3{
+            m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+            m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+            m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3],
+        };
+    }
+
+    __forceinline vec3 transform_vector(const vec3& v) const {
+        return vec3{
+            m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+            m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+            m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z(),
+        };
+    }
+
+    // Applies the transposed linear part. Called on the inverse of a transform it maps normals
+    // through that transform (inverse transpose), so no separate normal matrix has to be stored.
+    __forceinline vec3 transform_normal(const vec3& n) const {
+        return vec3{
+            m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+            m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+            m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z(),
+        };
+    }
+
+    // Of the linear part, |det| is the volume scale and |det|^(2/3) the area scale of a uniform scaling
+    float determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+             + m[0][1] * (m[1][2] * m[2][0] - m[1][0] * m[2][2])
+             + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // Called on world_to_object: converts a density per unit solid angle of object space directions into one
+    // of world directions. w maps to L w / |L w|, a change of |det L| / |L w|^3 in solid angle for unit w,
+    // which is exactly 1 for rotations and uniform scalings.
+    float solid_angle_jacobian(const vec3& world_direction) const {
+        const float length{ transform_vector(unit_vector(world_direction)).length() };
+        return std::fabs(determinant()) / (length * length * length);
+    }
+
+    bool is_identity() const {
+        const affine3 unit{};
+        for (int row{}; row < 3; ++row) {
+            for (int col{}; col < 4; ++col) {
+                if (m[row][col] != unit.m[row][col])
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    affine3 inverse() const {
+        // Cofactors of the 3x3 block, the translation is then -inverse(linear) * t
+        const float c00{ m[1][1] * m[2][2] - m[1][2] * m[2][1] };
+        const float c01{ m[1][2] * m[2][0] - m[1][0] * m[2][2] };
+        const float c02{ m[1][0] * m[2][1] - m[1][1] * m[2][0] };
+        const float inv_det{ 1.f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02) };
+
+        affine3 result{};
+        result.m[0][0] = c00 * inv_det;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        result.m[1][0] = c01 * inv_det;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        result.m[2][0] = c02 * inv_det;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        const vec3 inv_translation{ result.transform_vector(vec3{ m[0][3], m[1][3], m[2][3] }) };
+        result.m[0][3] = -inv_translation.x();
+        result.m[1][3] = -inv_translation.y();
+        result.m[2][3] = -inv_translation.z();
+        return result;
+    }
+
+    aabb transform_box(const aabb& box) const {
+        point3 min{  infinity,  infinity,  infinity };
+        point3 max{ -infinity, -infinity, -infinity };
+
+        for (int i{}; i < 2; ++i) {
+            for (int j{}; j < 2; ++j) {
+                for (int k{}; k < 2; ++k) {
+                    const point3 corner{ transform_point(point3{
+                        i ? box.x.max : box.x.min,
+                        j ? box.y.max : box.y.min,
+                        k ? box.z.max : box.z.min }) };
+
+                    for (int c{}; c < 3; ++c) {
+                        min[c] = std::fmin(min[c], corner[c]);
+                        max[c] = std::fmax(max[c], corner[c]);
+                    }
+                }
+            }
+        }
+
+        return aabb(min, max);
+    }
+};
+#pragma endregion
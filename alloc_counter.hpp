@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+
+// Debug builds count heap allocations per thread so hot loops can prove they never touch the heap.
+// Replacing the global operators is fine here because everything is compiled as one translation unit.
+#ifdef _DEBUG
+    #include <cstdlib>
+    #include <new>
+    #ifdef _WIN32
+        #include <malloc.h>
+    #endif
+
+    inline thread_local std::size_t g_thread_allocations{ 0 };
+
+    inline void* counted_alloc(std::size_t size) {
+        ++g_thread_allocations;
+        if (void* ptr{ std::malloc(size ? size : 1) })
+            return ptr;
+        throw std::bad_alloc{};
+    }
+
+    // Over-aligned types (alignas tiles, blocks and nodes) come through here, they have to be counted as well.
+    // MSVC has no std::aligned_alloc and its blocks need their own free, elsewhere the size must be a multiple.
+    inline void* counted_aligned_alloc(std::size_t size, std::align_val_t alignment) {
+        ++g_thread_allocations;
+        const auto align{ static_cast<std::size_t>(alignment) };
+        size = (size ? size + align - 1 : align) / align * align;
+    #ifdef _WIN32
+        void* ptr{ _aligned_malloc(size, align) };
+    #else
+        void* ptr{ std::aligned_alloc(align, size) };
+    #endif
+        if (ptr)
+            return ptr;
+        throw std::bad_alloc{};
+    }
+
+    inline void aligned_free(void* ptr) {
+    #ifdef _WIN32
+        _aligned_free(ptr);
+    #else
+        std::free(ptr);
+    #endif
+    }
+
+    void* operator new(std::size_t size) { return counted_alloc(size); }
+    void* operator new[](std::size_t size) { return counted_alloc(size); }
+    void* operator new(std::size_t size, std::align_val_t alignment) { return counted_aligned_alloc(size, alignment); }
+    void* operator new[](std::size_t size, std::align_val_t alignment) { return counted_aligned_alloc(size, alignment); }
+
+    void operator delete(void* ptr) noexcept { std::free(ptr); }
+    void operator delete[](void* ptr) noexcept { std::free(ptr); }
+    void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+    void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+    void operator delete(void* ptr, std::align_val_t) noexcept { aligned_free(ptr); }
+    void operator delete[](void* ptr, std::align_val_t) noexcept { aligned_free(ptr); }
+    void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { aligned_free(ptr); }
+    void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { aligned_free(ptr); }
+
+    inline std::size_t thread_allocation_count() { return g_thread_allocations; }
+#else
+    inline std::size_t thread_allocation_count() { return 0; }
+#endif
@@ -0,0 +1,124 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// iclude order matters, same as scenes.hpp
+#include "camera.hpp"
+#include "material.hpp"
+#include "primitive_block.hpp"
+#include "quad.hpp"
+#include "sphere.hpp"
+
+// The SSE blocks replace the scalar leaf loop, both have to pick the same primitive at the same t. Scalar reference:
+// intersect every primitive in order, shrinking ray_t on each hit. Blocks are filled with one to four primitives.
+constexpr int N{ 200'000 };
+
+auto random_target() -> ray
+{
+    const point3 origin{ point3::random(-6.f, 6.f) };
+    const point3 target{ point3::random(-2.f, 2.f) };
+    return ray(origin, target - origin, random_float());
+}
+
+auto check_spheres(const std::shared_ptr<material>& mat) -> int
+{
+    int mismatches{ 0 };
+    int hits{ 0 };
+
+    for (int i{ 0 }; i < N; ++i)
+    {
+        std::vector<sphere> spheres;
+        sphere_block block{};
+        const int count{ 1 + i % 4 };
+        for (int lane{ 0 }; lane < count; ++lane)
+        {
+            const point3 center{ point3::random(-2.f, 2.f) };
+            const vec3 motion{ lane % 2 ? vec3::random(-1.f, 1.f) : vec3(0.f, 0.f, 0.f) };
+            spheres.emplace_back(center, center + motion, random_float(.2f, 1.f), mat);
+        }
+        for (int lane{ 0 }; lane < count; ++lane)
+            block.add(spheres[lane], static_cast<uint32_t>(lane));
+
+        const ray r{ random_target() };
+        interval ray_t{ 0.001f, infinity };
+        hit_record rec{};
+        int expected{ -1 };
+        for (int lane{ 0 }; lane < count; ++lane)
+        {
+            if (spheres[lane].intersect(r, ray_t, rec))
+            {
+                expected = lane;
+                ray_t.max = rec.t;
+            }
+        }
+
+        float t{};
+        const int lane{ block.intersect(simd_ray{ r }, interval(0.001f, infinity), t) };
+        if (expected >= 0)
+            ++hits;
+        if (lane != expected || (lane >= 0 && std::fabs(t - rec.t) > 1e-5f * rec.t))
+            ++mismatches;
+    }
+
+    std::cout << "sphere blocks: " << mismatches << " of " << N << " rays disagree with sphere::intersect (" << hits << " hits)\n";
+    return mismatches;
+}
+
+auto check_quads(const std::shared_ptr<material>& mat) -> int
+{
+    int mismatches{ 0 };
+    int hits{ 0 };
+
+    for (int i{ 0 }; i < N; ++i)
+    {
+        std::vector<quad> quads;
+        quad_block block{};
+        const int count{ 1 + i % 4 };
+        for (int lane{ 0 }; lane < count; ++lane)
+            quads.emplace_back(point3::random(-2.f, 2.f), vec3::random(-2.f, 2.f), vec3::random(-2.f, 2.f), mat);
+        for (int lane{ 0 }; lane < count; ++lane)
+            block.add(quads[lane], static_cast<uint32_t>(lane));
+
+        const ray r{ random_target() };
+        interval ray_t{ 0.001f, infinity };
+        hit_record rec{};
+        int expected{ -1 };
+        for (int lane{ 0 }; lane < count; ++lane)
+        {
+            // quad's interval is inclusive, a later quad at the same t must not take over from the lower lane
+            hit_record candidate{};
+            if (quads[lane].intersect(r, ray_t, candidate) && (expected < 0 || candidate.t < rec.t))
+            {
+                expected = lane;
+                rec = candidate;
+                ray_t.max = rec.t;
+            }
+        }
+
+        float t{}, alpha{}, beta{};
+        const int lane{ block.intersect(simd_ray{ r }, interval(0.001f, infinity), t, alpha, beta) };
+        if (expected >= 0)
+            ++hits;
+        if (lane != expected)
+            ++mismatches;
+        else if (lane >= 0 && (std::fabs(t - rec.t) > 1e-5f * rec.t || std::fabs(alpha - rec.u) > 1e-4f || std::fabs(beta - rec.v) > 1e-4f))
+            ++mismatches;
+    }
+
+    std::cout << "quad blocks: " << mismatches << " of " << N << " rays disagree with quad::intersect (" << hits << " hits)\n";
+    return mismatches;
+}
+
+auto main() -> int
+{
+    auto mat{ std::make_shared<lambertian>(color(.5f, .5f, .5f)) };
+
+    int failures{ 0 };
+    failures += check_spheres(mat);
+    failures += check_quads(mat);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "entity.hpp"
+#include "material.hpp"
+#include "rtweekend.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#pragma region axis aligned box
+// Solid box as one primitive: a single slab test instead of six quads with six plane tests.
+// Face normal and uv are only worked out for the closest hit, the uv of each face matches
+// the quad the old six sided box() used for that face.
+class axis_aligned_box : public entity {
+
+    point3 box_min;
+    point3 box_max;
+    std::shared_ptr<material> mat;
+    aabb bbox;
+    float area;
+
+    // Entry and exit distances along r, t_enter > t_exit when the ray misses
+    void slab_distances(const ray& r, float& t_enter, float& t_exit) const {
+        t_enter = -infinity;
+        t_exit = infinity;
+
+        for (int axis{}; axis < 3; ++axis) {
+            const float inv_dir{ 1.f / r.direction()[axis] };
+            float t0{ (box_min[axis] - r.origin()[axis]) * inv_dir };
+            float t1{ (box_max[axis] - r.origin()[axis]) * inv_dir };
+            if (inv_dir < 0.f)
+                std::swap(t0, t1);
+
+            t_enter = std::max(t_enter, t0);
+            t_exit = std::min(t_exit, t1);
+        }
+    }
+
+    float face_area(int axis) const {
+        const vec3 size{ box_max - box_min };
+        return size[(axis + 1) % 3] * size[(axis + 2) % 3];
+    }
+
+public:
+
+    axis_aligned_box(const point3& a, const point3& b, std::shared_ptr<material> mat)
+        : box_min{ std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z()) }
+        , box_max{ std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z()) }
+        , mat{ mat }
+    {
+        bbox = aabb(box_min, box_max);
+        area = 2.f * (face_area(0) + face_area(1) + face_area(2));
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void collect_emitters(const affine3& object_to_world, std::vector<emitter>& emitters) const override {
+        const float radiance{ luminance(mat->average_emission()) };
+        if (radiance > 0.f)
+            emitters.push_back(make_emitter(*this, object_to_world, radiance, area, vec3(0.f, 0.f, 1.f), -1.f));
+    }
+
+    // The entry distance, or the exit distance when the ray starts inside (dielectric and medium boundaries)
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        float t_enter, t_exit;
+        slab_distances(r, t_enter, t_exit);
+
+        if (t_enter > t_exit)
+            return false;
+
+        if (ray_t.surrounds(t_enter))
+            rec.t = t_enter;
+        else if (ray_t.surrounds(t_exit))
+            rec.t = t_exit;
+        else
+            return false;
+
+        rec.object = this;
+        return true;
+    }
+
+    void surface_interaction(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.mat = mat.get();
+
+        // The face is the box plane the hit point lies closest to
+        int face_axis{ 0 };
+        bool face_is_max{ false };
+        float closest{ infinity };
+        for (int axis{}; axis < 3; ++axis) {
+            const float to_min{ std::fabs(rec.p[axis] - box_min[axis]) };
+            const float to_max{ std::fabs(rec.p[axis] - box_max[axis]) };
+            if (to_min < closest) { closest = to_min; face_axis = axis; face_is_max = false; }
+            if (to_max < closest) { closest = to_max; face_axis = axis; face_is_max = true; }
+        }
+
+        vec3 outward_normal{ 0.f, 0.f, 0.f };
+        outward_normal[face_axis] = face_is_max ? 1.f : -1.f;
+        set_face_normal(rec, r, outward_normal);
+
+        // A flat box has no extent along one axis, its coordinate there is 0 instead of 0 / 0
+        const vec3 size{ box_max - box_min };
+        const auto relative{ [&](int axis) { return size[axis] > 0.f ? (rec.p[axis] - box_min[axis]) / size[axis] : 0.f; } };
+        const float x{ relative(0) };
+        const float y{ relative(1) };
+        const float z{ relative(2) };
+
+        switch (face_axis * 2 + face_is_max) {
+            case 0: rec.u = z;       rec.v = y;       break; // left
+            case 1: rec.u = 1.f - z; rec.v = y;       break; // right
+            case 2: rec.u = x;       rec.v = z;       break; // bottom
+            case 3: rec.u = x;       rec.v = 1.f - z; break; // top
+            case 4: rec.u = 1.f - x; rec.v = y;       break; // back
+            default: rec.u = x;      rec.v = y;       break; // front
+        }
+    }
+
+    // Uniform over the whole surface, so a direction can come from the entry or the exit face and both count
+    float pdf_value(const point3& origin, const vec3& direction) const override {
+        const ray r{ origin, direction };
+        float t_enter, t_exit;
+        slab_distances(r, t_enter, t_exit);
+
+        if (t_enter > t_exit || t_exit <= 0.001f)
+            return 0.f;
+
+        float pdf{ 0.f };
+        for (const float t : { t_enter, t_exit }) {
+            if (t <= 0.001f)
+                continue;
+
+            hit_record rec{};
+            rec.t = t;
+            surface_interaction(r, rec);
+
+            const float distance_squared{ t * t * direction.squared_length() };
+            const float cosine{ std::fabs(dot(direction, rec.normal) / direction.length()) };
+            pdf += distance_squared / (cosine * area);
+        }
+
+        return pdf;
+    }
+
+    vec3 random(const point3& origin) const override {
+        // Face picked by area, then a uniform point on it
+        float pick{ random_float() * 0.5f * area };
+        int axis{ 0 };
+        while (axis < 2 && pick > face_area(axis)) {
+            pick -= face_area(axis);
+            ++axis;
+        }
+
+        point3 p{ box_min + vec3(random_float(), random_float(), random_float()) * (box_max - box_min) };
+        p[axis] = random_float() < 0.5f ? box_min[axis] : box_max[axis];
+        return p - origin;
+    }
+};
+#pragma endregion
+
+__forceinline std::shared_ptr<axis_aligned_box> box(const point3& a, const point3& b, std::shared_ptr<material> mat) {
+    return std::make_shared<axis_aligned_box>(a, b, mat);
+}
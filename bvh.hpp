@@ -6,87 +6,487 @@
 #include "aabb.hpp"
 #include "entity.hpp"
 #include "entitylist.hpp"
+#include "primitive.hpp"
 #include "rtweekend.hpp"
 
+#include "threading/thread_pool.hpp"
+
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#pragma region linear BVH node
+// Node of the flattened tree, 32 bytes so two of them share a cache line.
+// Interior node: first child is stored right after the node, offset is the index of the second child.
+// Leaf: primitive_count > 0 and offset is the first of its primitives, which are stored in leaf order.
+struct linear_bvh_node {
+    aabb bbox;                     // 24 bytes
+    uint32_t offset{};
+    uint16_t primitive_count{};
+    uint8_t axis{};                // split axis, picks the near child during traversal
+    uint8_t pad{};
+};
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should stay 32 bytes");
+#pragma endregion
+
+#pragma region BVH build options
+enum class bvh_split_method {
+    median,     // sort on the longest axis and split in the middle
+    sah         // binned surface area heuristic
+};
+
+struct bvh_build_options {
+    bvh_split_method split_method{ bvh_split_method::median };
+    size_t max_leaf_primitives{ 2 };    // SAH may stop earlier, median splits until a span fits
+    float traversal_cost{ 0.125f };     // cost of visiting a node relative to one primitive intersection
+    size_t leaf_batch_width{ 1 };       // primitives a leaf tests at once, SAH charges a partial batch as a full one
+    interval shutter{ 0.f, 1.f };       // camera shutter, bvh4 stores bounds at its open and close for moving primitives
+    bool print_stats{ false };          // node counts and SAH cost to std::clog once built
+};
+#pragma endregion
 
 #pragma region BHV decl
+// Whole hierarchy in one entity: nodes live in one contiguous array and are traversed with an explicit stack,
+// leaves hold the primitives by value and dispatch on their variant tag.
 class bvh_node : public entity {
 
-    std::shared_ptr<entity> left;
-    std::shared_ptr<entity> right;
+    // Per primitive build data so the builder never calls bounding_box() through the vtable
+    struct build_primitive {
+        aabb bbox;
+        point3 centroid;
+        uint32_t index{};
+    };
+
+    struct sah_bin {
+        aabb bbox{ aabb::empty };
+        size_t count{};
+    };
+
+    std::vector<linear_bvh_node> nodes;
+    std::vector<primitive> primitives; // reordered so every leaf owns a contiguous range
     aabb bbox;
+    bvh_build_options options;
+
+    static constexpr size_t max_leaf_limit{ UINT16_MAX };
+    static constexpr int sah_bin_count{ 16 };
+    static constexpr int max_traversal_depth{ 64 }; // traversal stack size, a leaf at depth d leaves d entries on it
+    static constexpr int max_sah_depth{ 32 };       // deeper splits take the median, keeps the tree under 64 levels
 
-    static bool box_compare(const std::shared_ptr<entity> a, const std::shared_ptr<entity> b
-        , int axis_index) {
-        auto a_axis_interval{ a->bounding_box().axis_interval(axis_index) };
-        auto b_axis_interval{ b->bounding_box().axis_interval(axis_index) };
-        return a_axis_interval.min < b_axis_interval.min;
+    // Intersection cost of count primitives in units of one test (or one batch)
+    float primitive_cost(size_t count) const {
+        return static_cast<float>((count + options.leaf_batch_width - 1) / options.leaf_batch_width);
     }
 
-    static bool box_x_compare(const std::shared_ptr<entity> a, const std::shared_ptr<entity> b) {
-        return box_compare(a, b, 0);
+    // Zero for an axis the centroids don't spread along, everything lands in bin 0 and the axis is never split.
+    // Don't lean on aabb padding thin centroid bounds, 16 / 0 makes the bin index 0 * inf = NaN and NaN to int is UB.
+    static float sah_bin_scale(const interval& extent) {
+        const float scale{ sah_bin_count / extent.size() };
+        return extent.size() > 0.f && std::isfinite(scale) ? scale : 0.f;
     }
 
-    static bool box_y_compare(const std::shared_ptr<entity> a, const std::shared_ptr<entity> b) {
-        return box_compare(a, b, 1);
+    static int sah_bin_index(float centroid, const interval& extent, float bin_scale) {
+        return std::clamp(static_cast<int>((centroid - extent.min) * bin_scale), 0, sah_bin_count - 1);
     }
+    static constexpr size_t parallel_build_threshold{ 4'096 }; // spans below this are built serially
 
-    static bool box_z_compare(const std::shared_ptr<entity> a, const std::shared_ptr<entity> b) {
-        return box_compare(a, b, 2);
+    static uint32_t make_leaf(std::vector<linear_bvh_node>& out, uint32_t node_index, const aabb& node_bbox
+        , size_t start, size_t end) {
+        out[node_index].bbox = node_bbox;
+        out[node_index].offset = static_cast<uint32_t>(start);
+        out[node_index].primitive_count = static_cast<uint16_t>(end - start);
+        return node_index;
     }
 
-public:
+    // Runs fn(chunk, chunk_start, chunk_end) over [start, end), spread over the pool when the range is big enough
+    template <typename Chunk_fn>
+    static size_t for_each_chunk(thread_pool_ws* pool, size_t start, size_t end, Chunk_fn&& fn) {
+        const size_t span{ end - start };
+        size_t chunk_count{ 1 };
+        if (pool && span >= parallel_build_threshold)
+            chunk_count = std::min(pool->thread_count() + 1, span / (parallel_build_threshold / 4));
+
+        if (chunk_count <= 1) {
+            fn(size_t{ 0 }, start, end);
+            return 1;
+        }
+
+        const size_t chunk_span{ (span + chunk_count - 1) / chunk_count };
+        std::vector<std::future<void>> chunks;
+        chunks.reserve(chunk_count - 1);
+
+        for (size_t chunk{ 1 }; chunk < chunk_count; ++chunk) {
+            size_t chunk_start{ std::min(start + chunk * chunk_span, end) };
+            size_t chunk_end{ std::min(chunk_start + chunk_span, end) };
+            chunks.push_back(pool->submit([&fn, chunk, chunk_start, chunk_end] { fn(chunk, chunk_start, chunk_end); }));
+        }
+
+        fn(size_t{ 0 }, start, std::min(start + chunk_span, end));
+
+        for (auto& chunk : chunks) {
+            pool->wait_for(chunk);
+            chunk.get();
+        }
+        return chunk_count;
+    }
+
+    static aabb bounds_of(thread_pool_ws* pool, const std::vector<build_primitive>& build_prims
+        , size_t start, size_t end, bool centroids) {
+        std::vector<aabb> partial(pool ? pool->thread_count() + 1 : 1, aabb::empty);
+
+        size_t chunk_count{ for_each_chunk(pool, start, end, [&](size_t chunk, size_t chunk_start, size_t chunk_end) {
+            aabb bounds{ aabb::empty };
+            for (size_t i{ chunk_start }; i < chunk_end; ++i) {
+                bounds = centroids ? aabb(bounds, aabb(build_prims[i].centroid, build_prims[i].centroid))
+                                   : aabb(bounds, build_prims[i].bbox);
+            }
+            partial[chunk] = bounds;
+        }) };
+
+        aabb bounds{ aabb::empty };
+        for (size_t chunk{ 0 }; chunk < chunk_count; ++chunk)
+            bounds = aabb(bounds, partial[chunk]);
+        return bounds;
+    }
+
+    static size_t split_median(std::vector<build_primitive>& build_prims, size_t start, size_t end, int axis) {
+        // Only the median has to land in place, a full sort per level is wasted work
+        auto mid{ start + (end - start) / 2 };
+        std::nth_element(std::begin(build_prims) + start, std::begin(build_prims) + mid, std::begin(build_prims) + end
+            , [axis](const build_primitive& a, const build_primitive& b) {
+                return a.bbox.axis_interval(axis).min < b.bbox.axis_interval(axis).min;
+            });
 
-    bvh_node(entity_list list) : bvh_node(list.entities, 0, list.entities.size()) {
-        // There's a C++ subtlety here. This constructor (without span indices) creates an
-        // implicit copy of the hittable list, which we will modify. The lifetime of the copied
-        // list only extends until this constructor exits. That's OK, because we only need to
-        // persist the resulting bounding volume hierarchy.
+        return mid;
     }
 
-    bvh_node(std::vector<std::shared_ptr<entity>>& entities, size_t start, size_t end) {
-        
-        bbox = aabb::empty;
-        for (size_t ent_index=start; ent_index < end; ++ent_index)
-            bbox = aabb(bbox, entities[ent_index]->bounding_box());
+    // Binned SAH over all three axes, returns end when a leaf is cheaper than any split
+    size_t split_sah(thread_pool_ws* pool, std::vector<build_primitive>& build_prims, size_t start, size_t end
+        , const aabb& node_bbox, int& split_axis) const {
 
-        int axis = bbox.longest_axis();
+        const aabb centroid_bounds{ bounds_of(pool, build_prims, start, end, true) };
+
+        // Bin all three axes in one pass, per chunk, then merge
+        using axis_bins = std::array<std::array<sah_bin, sah_bin_count>, 3>;
+        std::vector<axis_bins> partial_bins(pool ? pool->thread_count() + 1 : 1);
+
+        size_t chunk_count{ for_each_chunk(pool, start, end, [&](size_t chunk, size_t chunk_start, size_t chunk_end) {
+            axis_bins& bins{ partial_bins[chunk] };
+            for (int axis{ 0 }; axis < 3; ++axis) {
+                const interval& extent{ centroid_bounds.axis_interval(axis) };
+                const float bin_scale{ sah_bin_scale(extent) };
+                if (bin_scale == 0.f)
+                    continue;
+
+                for (size_t i{ chunk_start }; i < chunk_end; ++i) {
+                    const int b{ sah_bin_index(build_prims[i].centroid[axis], extent, bin_scale) };
+                    ++bins[axis][b].count;
+                    bins[axis][b].bbox = aabb(bins[axis][b].bbox, build_prims[i].bbox);
+                }
+            }
+        }) };
+
+        for (size_t chunk{ 1 }; chunk < chunk_count; ++chunk) {
+            for (int axis{ 0 }; axis < 3; ++axis) {
+                for (int b{ 0 }; b < sah_bin_count; ++b) {
+                    partial_bins[0][axis][b].count += partial_bins[chunk][axis][b].count;
+                    partial_bins[0][axis][b].bbox = aabb(partial_bins[0][axis][b].bbox, partial_bins[chunk][axis][b].bbox);
+                }
+            }
+        }
+
+        const size_t span{ end - start };
+        const float node_area{ node_bbox.surface_area() };
+        float best_cost{ infinity };
+        int best_axis{ -1 };
+        int best_split{ 0 };
+
+        for (int axis{ 0 }; axis < 3; ++axis) {
+            if (sah_bin_scale(centroid_bounds.axis_interval(axis)) == 0.f)
+                continue;
+
+            const auto& bins{ partial_bins[0][axis] };
+
+            // Sweep from the right to get the cost of everything above each split plane
+            std::array<float, sah_bin_count - 1> right_cost{};
+            aabb right_bbox{ aabb::empty };
+            size_t right_count{ 0 };
+            for (int b{ sah_bin_count - 1 }; b > 0; --b) {
+                right_bbox = aabb(right_bbox, bins[b].bbox);
+                right_count += bins[b].count;
+                right_cost[b - 1] = primitive_cost(right_count) * right_bbox.surface_area();
+            }
+
+            aabb left_bbox{ aabb::empty };
+            size_t left_count{ 0 };
+            for (int b{ 0 }; b < sah_bin_count - 1; ++b) {
+                left_bbox = aabb(left_bbox, bins[b].bbox);
+                left_count += bins[b].count;
+
+                if (left_count == 0 || left_count == span)
+                    continue;
+
+                float cost{ options.traversal_cost
+                    + (primitive_cost(left_count) * left_bbox.surface_area() + right_cost[b]) / node_area };
+
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        // Every centroid in the same spot, bins can't separate them
+        if (best_axis < 0) {
+            if (span <= options.max_leaf_primitives)
+                return end;
+            split_axis = node_bbox.longest_axis();
+            return split_median(build_prims, start, end, split_axis);
+        }
+
+        const float leaf_cost{ primitive_cost(span) };
+        if (span <= options.max_leaf_primitives && leaf_cost <= best_cost)
+            return end;
+
+        split_axis = best_axis;
+        const interval& extent{ centroid_bounds.axis_interval(best_axis) };
+        const float bin_scale{ sah_bin_scale(extent) };
+
+        auto mid{ std::partition(std::begin(build_prims) + start, std::begin(build_prims) + end
+            , [=](const build_primitive& prim) {
+                return sah_bin_index(prim.centroid[best_axis], extent, bin_scale) <= best_split;
+            }) };
+
+        return static_cast<size_t>(mid - std::begin(build_prims));
+    }
+
+    // Appends a subtree built into its own array, interior offsets are relative to that array
+    static void append_subtree(std::vector<linear_bvh_node>& out, const std::vector<linear_bvh_node>& subtree) {
+        const auto base{ static_cast<uint32_t>(out.size()) };
+        out.insert(std::end(out), std::begin(subtree), std::end(subtree));
+
+        for (size_t i{ base }; i < out.size(); ++i)
+            if (out[i].primitive_count == 0)
+                out[i].offset += base;
+    }
 
-        auto comparator{ (axis == 0) ? box_x_compare
-                       : (axis == 1) ? box_y_compare
-                                     : box_z_compare };
+    // Builds the subtree over build_prims [start, end) into out in depth first order, returns its node index.
+    // Large spans fork their first child onto the pool and are spliced back in order once both halves are done.
+    // SAH can peel off a few primitives per level, past max_sah_depth the median takes over and halves the span,
+    // so below 2^32 primitives no leaf ends deeper than the traversal stack.
+    uint32_t build(thread_pool_ws* pool, std::vector<linear_bvh_node>& out
+        , std::vector<build_primitive>& build_prims, size_t start, size_t end, int depth) const {
+        assert(depth <= max_traversal_depth);
+        const auto node_index{ static_cast<uint32_t>(out.size()) };
+        out.emplace_back();
 
         size_t object_span{ end - start };
+        if (object_span < parallel_build_threshold)
+            pool = nullptr;
 
-        if (object_span == 1) {
-            left = right = entities[start];
-        } else if (object_span == 2) {
-            left = entities[start];
-            right = entities[start + 1];
+        const aabb node_bbox{ bounds_of(pool, build_prims, start, end, false) };
+
+        if (object_span == 1)
+            return make_leaf(out, node_index, node_bbox, start, end);
+
+        int axis{ node_bbox.longest_axis() };
+        size_t mid{};
+
+        if (options.split_method == bvh_split_method::sah && depth < max_sah_depth) {
+            mid = split_sah(pool, build_prims, start, end, node_bbox, axis);
+            if (mid == end)
+                return make_leaf(out, node_index, node_bbox, start, end);
         } else {
-            std::sort(std::begin(entities) + start, std::begin(entities) + end, comparator );
+            if (object_span <= options.max_leaf_primitives)
+                return make_leaf(out, node_index, node_bbox, start, end);
+            mid = split_median(build_prims, start, end, axis);
+        }
+
+        uint32_t second_child{};
+
+        if (pool) {
+            std::vector<linear_bvh_node> first_nodes;
+            std::vector<linear_bvh_node> second_nodes;
+
+            auto first_half{ pool->submit([&, pool, start, mid] {
+                build(pool, first_nodes, build_prims, start, mid, depth + 1);
+            }) };
+            build(pool, second_nodes, build_prims, mid, end, depth + 1);
 
-            auto mid{ start + object_span / 2 };
-            left = std::make_shared<bvh_node>(entities, start, mid);
-            right = std::make_shared<bvh_node>(entities, mid, end);
+            pool->wait_for(first_half);
+            first_half.get();
+
+            append_subtree(out, first_nodes);
+            second_child = static_cast<uint32_t>(out.size());
+            append_subtree(out, second_nodes);
+        } else {
+            build(nullptr, out, build_prims, start, mid, depth + 1);
+            second_child = build(nullptr, out, build_prims, mid, end, depth + 1);
         }
 
-        bbox = aabb(left->bounding_box(), right->bounding_box());
+        // out may have been reallocated by the recursive calls, index instead of holding a reference
+        out[node_index].bbox = node_bbox;
+        out[node_index].offset = second_child;
+        out[node_index].axis = static_cast<uint8_t>(axis);
+        return node_index;
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        if (!bbox.hit(r, ray_t))
+public:
+
+    bvh_node(entity_list list, bvh_build_options build_options = {}) : options{ build_options } {
+        options.max_leaf_primitives = std::clamp<size_t>(options.max_leaf_primitives, 1, max_leaf_limit);
+        options.leaf_batch_width = std::max<size_t>(options.leaf_batch_width, 1);
+
+        if (list.entities.empty()) {
+            bbox = aabb::empty;
+            return;
+        }
+
+        std::vector<build_primitive> build_prims(list.entities.size());
+        for (size_t i{ 0 }; i < build_prims.size(); ++i) {
+            build_prims[i].bbox = list.entities[i]->bounding_box();
+            build_prims[i].centroid = build_prims[i].bbox.centroid();
+            build_prims[i].index = static_cast<uint32_t>(i);
+        }
+
+        if (build_prims.size() >= parallel_build_threshold) {
+            // Only big scenes pay for spinning up workers, they are gone again before rendering starts
+            thread_pool_ws build_pool{ "building the BVH" };
+            build(&build_pool, nodes, build_prims, 0, build_prims.size(), 0);
+        } else {
+            nodes.reserve(2 * build_prims.size());
+            build(nullptr, nodes, build_prims, 0, build_prims.size(), 0);
+        }
+        nodes.shrink_to_fit();
+        bbox = nodes[0].bbox;
+
+        // Leaves index build_prims, store the primitives in that same leaf order
+        primitives.reserve(build_prims.size());
+        for (const auto& prim : build_prims)
+            primitives.push_back(make_primitive(std::move(list.entities[prim.index])));
+
+        if (options.print_stats)
+            std::clog << "BVH built: " << primitives.size() << " primitives, " << nodes.size()
+                << " nodes, SAH cost " << sah_cost() << "\n";
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty())
             return false;
-        
-        bool hit_left{ left->hit(r, ray_t, rec) };
-        bool hit_right{ right->hit(r
-                , interval(ray_t.min, hit_left ? rec.t : ray_t.max)
-                , rec) };
-        
-        return hit_left || hit_right;
+
+        const traversal_ray tr{ r };
+
+        uint32_t to_visit[max_traversal_depth];
+        int to_visit_count{ 0 };
+        uint32_t current{ 0 };
+        bool hit_anything{ false };
+
+        while (true) {
+            const linear_bvh_node& node{ nodes[current] };
+
+            if (node.bbox.hit(tr, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i{ 0 }; i < node.primitive_count; ++i) {
+                        if (intersect_primitive(primitives[node.offset + i], r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                } else {
+                    // Visit the child on the ray's side of the split first, the far one is often culled by then
+                    assert(to_visit_count < max_traversal_depth);
+                    if (tr.dir_is_neg[node.axis]) {
+                        to_visit[to_visit_count++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        to_visit[to_visit_count++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (to_visit_count == 0)
+                break;
+            current = to_visit[--to_visit_count];
+        }
+
+        return hit_anything;
+    }
+
+    // Same walk as intersect but done at the first primitive hit, the near child order still finds one sooner
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty())
+            return false;
+
+        const traversal_ray tr{ r };
+
+        uint32_t to_visit[max_traversal_depth];
+        int to_visit_count{ 0 };
+        uint32_t current{ 0 };
+
+        while (true) {
+            const linear_bvh_node& node{ nodes[current] };
+
+            if (node.bbox.hit(tr, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i{ 0 }; i < node.primitive_count; ++i) {
+                        if (occluded_primitive(primitives[node.offset + i], r, ray_t))
+                            return true;
+                    }
+                } else {
+                    assert(to_visit_count < max_traversal_depth);
+                    if (tr.dir_is_neg[node.axis]) {
+                        to_visit[to_visit_count++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        to_visit[to_visit_count++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (to_visit_count == 0)
+                break;
+            current = to_visit[--to_visit_count];
+        }
+
+        return false;
     }
-    
+
     aabb bounding_box() const override { return bbox; }
+
+    void collect_emitters(const affine3& object_to_world, std::vector<emitter>& emitters) const override {
+        for (const primitive& prim : primitives)
+            collect_primitive_emitters(prim, object_to_world, emitters);
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+    const std::vector<linear_bvh_node>& linear_nodes() const { return nodes; }
+    const std::vector<primitive>& ordered_primitives() const { return primitives; }
+
+    // Expected cost of a random ray against the tree in units of one primitive intersection,
+    // lets median and SAH builds (or different cost ratios) be compared on the same scene.
+    float sah_cost() const {
+        if (nodes.empty())
+            return 0.f;
+
+        const float root_area{ nodes[0].bbox.surface_area() };
+        if (root_area <= 0.f)
+            return 0.f;
+
+        float cost{ 0.f };
+        for (const auto& node : nodes) {
+            const float relative_area{ node.bbox.surface_area() / root_area };
+            cost += relative_area * (node.primitive_count > 0 ? primitive_cost(node.primitive_count) : options.traversal_cost);
+        }
+        return cost;
+    }
 };
-#pragma endregion
\ No newline at end of file
+#pragma endregion
@@ -0,0 +1,63 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// iclude order matters, same as scenes.hpp
+#include "camera.hpp"
+#include "entitylist.hpp"
+#include "material.hpp"
+#include "sphere.hpp"
+#include "wide_bvh.hpp"
+
+// The bvh4 has to find the same closest hit as testing every sphere, at any ray time. Motion bounds are fitted
+// to the build shutter, rays timed past it have to fall back to the swept boxes instead of dropping the spheres.
+auto check(const bvh4& tree, const entity_list& spheres, float time_min, float time_max, const char* name) -> int
+{
+    constexpr int N{ 20'000 };
+    int mismatches{ 0 };
+    int hits{ 0 };
+
+    for (int i{ 0 }; i < N; ++i)
+    {
+        const ray r{ point3::random(-60.f, 60.f), vec3::random(-1.f, 1.f), random_float(time_min, time_max) };
+        hit_record expected{};
+        hit_record found{};
+        const bool hit_expected{ spheres.hit(r, interval(0.001f, infinity), expected) };
+        const bool hit_found{ tree.hit(r, interval(0.001f, infinity), found) };
+
+        if (hit_expected)
+            ++hits;
+        if (hit_expected != hit_found || (hit_expected && std::fabs(expected.t - found.t) > 1e-4f * expected.t))
+            ++mismatches;
+    }
+
+    std::cout << name << ": " << mismatches << " of " << N << " rays disagree (" << hits << " hits)\n";
+    return mismatches;
+}
+
+auto main() -> int
+{
+    auto material{ std::make_shared<lambertian>(color(.5f, .5f, .5f)) };
+
+    // Spheres moving several radii, so the swept boxes are much larger than the boxes at either end
+    entity_list spheres;
+    for (int i{ 0 }; i < 2000; ++i)
+    {
+        const point3 center{ point3::random(-50.f, 50.f) };
+        spheres.add(std::make_shared<sphere>(center, center + vec3::random(-8.f, 8.f), random_float(.5f, 1.5f), material));
+    }
+
+    // Built for a short shutter, as the camera uses
+    const interval shutter{ 0.f, .25f };
+    const bvh4 tree{ spheres, bvh_build_options{ .split_method = bvh_split_method::sah, .max_leaf_primitives = 4, .shutter = shutter } };
+
+    int failures{ 0 };
+    failures += check(tree, spheres, shutter.min, shutter.max, "inside the shutter");
+    failures += check(tree, spheres, shutter.max, 1.f, "after the shutter");
+    failures += check(tree, spheres, 0.f, 1.f, "whole time range");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// iclude order matters, same as scenes.hpp
+#include "camera.hpp"
+#include "bvh.hpp"
+#include "entitylist.hpp"
+#include "material.hpp"
+#include "quad.hpp"
+#include "sphere.hpp"
+
+// SAH and median splits only change the shape of the tree, both have to find the closest hit testing every
+// primitive finds. The scenes include centroids the bins can't spread, coplanar and coincident ones.
+auto check(const entity_list& world, float extent, const char* name) -> int
+{
+    const bvh_node median{ world, bvh_build_options{ .split_method = bvh_split_method::median } };
+    const bvh_node sah{ world, bvh_build_options{ .split_method = bvh_split_method::sah, .max_leaf_primitives = 4 } };
+
+    constexpr int N{ 20'000 };
+    int mismatches{ 0 };
+    int hits{ 0 };
+
+    for (int i{ 0 }; i < N; ++i)
+    {
+        const ray r{ point3::random(-extent, extent), vec3::random(-1.f, 1.f), random_float() };
+        hit_record expected{};
+        hit_record from_median{};
+        hit_record from_sah{};
+        const bool hit_expected{ world.hit(r, interval(0.001f, infinity), expected) };
+        const bool hit_median{ median.hit(r, interval(0.001f, infinity), from_median) };
+        const bool hit_sah{ sah.hit(r, interval(0.001f, infinity), from_sah) };
+
+        if (hit_expected)
+            ++hits;
+        if (hit_median != hit_expected || hit_sah != hit_expected)
+            ++mismatches;
+        else if (hit_expected && (from_median.t != expected.t || from_sah.t != expected.t))
+            ++mismatches;
+    }
+
+    std::cout << name << ": " << mismatches << " of " << N << " rays disagree (" << hits << " hits)\n";
+    return mismatches;
+}
+
+auto main() -> int
+{
+    auto material{ std::make_shared<lambertian>(color(.5f, .5f, .5f)) };
+    int failures{ 0 };
+
+    entity_list scattered;
+    for (int i{ 0 }; i < 5000; ++i)
+        scattered.add(std::make_shared<sphere>(point3::random(-50.f, 50.f), random_float(.2f, 2.f), material));
+    failures += check(scattered, 60.f, "scattered spheres");
+
+    // Ground tiles, every centroid at y = 0
+    entity_list coplanar;
+    for (int x{ -30 }; x < 30; ++x)
+        for (int z{ -30 }; z < 30; ++z)
+            coplanar.add(std::make_shared<quad>(point3(x, 0.f, z), vec3(1.f, 0.f, 0.f), vec3(0.f, 0.f, 1.f), material));
+    failures += check(coplanar, 40.f, "coplanar quads");
+
+    // Nested shells, all centroids in one spot
+    entity_list coincident;
+    for (int i{ 1 }; i <= 200; ++i)
+        coincident.add(std::make_shared<sphere>(point3(0.f, 0.f, 0.f), .05f * i, material));
+    failures += check(coincident, 15.f, "coincident centroids");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -2,9 +2,14 @@
 #include "ray.hpp"
 #include "rtweekend.hpp"
 
+#include "accumulation_file.hpp"
+#include "alloc_counter.hpp"
+
 #include "color.hpp"
 #include "entity.hpp"
+#include "frame_buffer.hpp"
 #include "interval.hpp"
+#include "light_bvh.hpp"
 #include "pdf.hpp"
 #include "material.hpp"
 
@@ -12,9 +17,19 @@
 #include "gui_window/win_api_window.hpp"
 
 #include <chrono>
+#include <filesystem>
 #include <format>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <string>
+
+#pragma region integrator selection
+enum class integrator_mode {
+    mixture_pdf,    // one direction per vertex drawn 50/50 from the lights and the material, emitters are found by hitting them
+    nee_mis         // a light sample with its own ray at every non specular vertex plus the material sample, power heuristic
+};
+#pragma endregion
 
 #pragma region camera class declaration
 class camera {
@@ -25,6 +40,29 @@ public:
     int max_depth{ 10 };
     color background;
     double shuter_speed{ 1.0 }; // shuter speed for motion blur
+    uint32_t random_seed{ 0 }; // same seed renders a bit identical image regardless of thread count
+    int russian_roulette_depth{ 3 }; // bounces before paths can be terminated by russian roulette
+    integrator_mode integrator{ integrator_mode::mixture_pdf };
+    sampler_kind sampler{ sampler_kind::sobol }; // where pixel, lens, time and every bounce's decisions get their numbers
+
+    // Adaptive sampling, off at 0. samples_per_pixel then is the frame's average budget: pixels stop once their
+    // displayed_standard_error drops below adaptive_threshold and the samples they leave go to the noisy ones,
+    // up to adaptive_max_samples each (0: 8 x samples_per_pixel). A convergence map is written next to the image.
+    float adaptive_threshold{ 0.f };
+    int adaptive_min_samples{ 16 };
+    int adaptive_max_samples{ 0 };
+
+    // Wall clock budget in seconds, off at 0. The frame is then rendered in full passes of one sample per pixel
+    // until the budget runs out, samples_per_pixel and adaptive sampling are ignored.
+    float time_budget{ 0.f };
+
+    // Raw accumulation checkpoints (accumulation_file.hpp), off when empty. An existing file is resumed and every
+    // pixel carries on from its sample count, as long as it was written for the same scene_name, size,
+    // samples_per_pixel, max_depth and sampler; any other file is refused rather than mixed in.
+    // The file is rewritten every checkpoint_interval seconds and when the render ends.
+    std::string checkpoint_file{};
+    float checkpoint_interval{ 300.f };
+    std::string scene_name{}; // tells checkpoints of different scenes apart
 
     float vfov{ 90.f };
     point3 lookfrom{ point3{ 0, 0, -1 } };
@@ -39,19 +77,31 @@ public:
     vec3 vertical{};
     vec3 origin{};
 
-    void render(const entity& world, const entity& lights) {
+    // Ray times are drawn from [0, shuter_speed]. Motion BVHs have to be built for the same interval
+    // (bvh_build_options::shutter), scenes take it from here.
+    interval shutter() const { return interval(0.f, static_cast<float>(shuter_speed)); }
+
+    // Lights are the emissive primitives of world, found and put in a light_bvh before rendering
+    void render(const entity& world) {
+        const light_bvh lights{ world };
+        render(world, lights, !lights.empty());
+    }
+
+    // Set on every call rather than restored afterwards, a render that throws can't leave the next one without lights
+    void render(const entity& world, const entity& lights, bool light_sampling = true) {
+        sample_lights = light_sampling;
         initialize();
 
-        std::vector<color> frame_buffer(image_width * image_height, color(0, 0, 0));
-        std::mutex frame_buffer_mutex;
+        // Workers accumulate into thread private tile buffers and publish them at pass boundaries,
+        // the hot loop never touches shared memory.
+        frame_buffer frame{ image_width, image_height };
 
-        std::vector<int> current_samples(image_width * image_height, 0);
-        std::mutex samples_mutex;
-        
-        std::atomic<int> completed_tiles(0);
-        const int tile_size{ 16 };
-        int total_tiles = ((image_height + tile_size - 1) / tile_size) * 
-                        ((image_width + tile_size - 1) / tile_size);
+        checkpoint_seeds = { random_seed };
+        if (!checkpoint_file.empty() && std::filesystem::exists(checkpoint_file))
+            resume_checkpoint(frame);
+        last_checkpoint = std::chrono::steady_clock::now();
+
+        std::atomic<size_t> shading_allocations{ 0 }; // only counted in debug builds
 
         std::chrono::steady_clock::time_point g_render_start_time;
         std::atomic<bool> g_rendering_active{ false };
@@ -62,62 +112,21 @@ public:
 
         std::thread window_thread = std::thread(window_thread_func, GetModuleHandle(NULL)
             , image_width, image_height
-            , std::ref(frame_buffer), std::ref(current_samples)
-            , std::ref(frame_buffer_mutex), std::ref(samples_mutex)
+            , std::cref(frame)
             , std::ref(g_render_start_time), std::ref(g_rendering_active)
             , std::ref(g_render_time_str));
         
         thread_pool_ws thread_pool;
 
-        std::vector<std::future<void>> futures;
-
         std::clog << "Rendering..." << std::endl;
 
-        for (int j = 0; j < image_height; j += tile_size) {
-            for (int i = 0; i < image_width; i += tile_size) {
-                auto future = thread_pool.submit([this, &world, &frame_buffer, &lights, &frame_buffer_mutex
-                    , i, j, tile_size, &completed_tiles
-                    , total_tiles, &current_samples, &samples_mutex]() {
-                    
-                    int x_end{ std::min(i + tile_size, image_width) };
-                    int y_end{ std::min(j + tile_size, image_height) };
-
-                    // Render pixels in tile
-                    // Edited to sample every pixel in tile once and again
-                    // until rendered; not rendering one pixel fully then going to next pixel (it looks nicer in preview imo)
-                    for (int sample_j{ 0 }; sample_j < sqrt_samples_per_pixel; ++sample_j) {
-                        for (int sample_i{ 0 }; sample_i < sqrt_samples_per_pixel; ++sample_i) {
-                            for (int y{j}; y < y_end; ++y) {
-                                for (int x{i}; x < x_end; ++x) {
-                                    
-                                    ray r{ get_ray(x, y, sample_i, sample_j) };
-                                    color sample_color = ray_color(r, max_depth, world, lights);
-                                    
-                                    {
-                                        std::lock_guard<std::mutex> lock_frame_buf(frame_buffer_mutex);
-                                        std::lock_guard<std::mutex> lock_samples(samples_mutex);
-                                        frame_buffer[y * image_width + x] += sample_color;
-                                        current_samples[y * image_width + x] += 1;
-                                    }
-                                }
-                            }
-                        }
-                    } // my sampling more like 3D softwares uses
-
-                });
-
-                futures.push_back(std::move(future));
-            }
-        }
-
-        size_t total_futures{ futures.size() };
-        
-        for (auto& future: futures) {
-            future.wait();
-            ++completed_tiles;
-            std::clog << "\rCompleted " << completed_tiles << "/" << total_tiles
-            << " tiles (" << (completed_tiles * 100 / total_tiles) << "%)" << std::flush;
-        }
+        if (time_budget > 0.f)
+            render_timed(world, lights, frame, thread_pool, shading_allocations, g_render_start_time
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(time_budget)));
+        else if (adaptive_threshold > 0.f)
+            render_adaptive(world, lights, frame, thread_pool, shading_allocations);
+        else
+            render_fixed(world, lights, frame, thread_pool, shading_allocations);
 
         auto end_time{ std::chrono::steady_clock::now() };
         auto elapsed{ std::chrono::duration_cast<std::chrono::milliseconds>(end_time - g_render_start_time) };
@@ -132,11 +141,16 @@ public:
 
         g_rendering_active = false;
 
-        std::clog << "\rCompleted " << completed_tiles << "/" << total_tiles
-        << " tiles (" << (completed_tiles * 100 / total_tiles) << "%)\n";
         std::clog << g_render_time_str << "\n";
-
-        save_ppm_binary("renderer_output.ppm", frame_buffer, image_width, image_height, samples_per_pixel);
+#ifdef _DEBUG
+        std::clog << "Heap allocations in the shading path: " << shading_allocations << "\n";
+#endif
+
+        save_ppm_binary("renderer_output.ppm", frame.resolve(), image_width, image_height);
+        if (time_budget <= 0.f && adaptive_threshold > 0.f)
+            save_convergence_map("convergence_map.ppm", frame.resolve(), image_width, image_height);
+        if (!checkpoint_file.empty())
+            write_checkpoint(frame);
         std::clog << "Done.\n";
 
         if (window_thread.joinable()) {
@@ -150,21 +164,32 @@ public:
 
 private:
     int image_height{};
+    bool sample_lights{ true }; // set by render, false when the scene has no emitters and paths only follow the materials
     point3 center{};
     float pixel_samples_scale{};
     int sqrt_samples_per_pixel{};
-    float recip_sqrt_samples_per_pixel{};
     point3 pixel00_loc{};
     vec3 pixel_delta_u{};
     vec3 pixel_delta_v{};
     vec3 u{}, v{}, w{};
     vec3 defocus_disk_u{};
     vec3 defocus_disk_v{};
+    std::vector<uint32_t> checkpoint_seeds{}; // seeds of the resumed samples and ours
+    mutable std::chrono::steady_clock::time_point last_checkpoint{};
 
     void initialize();
-    ray get_ray(int i, int j, int sample_i, int sample_j) const;
+    accumulation checkpoint_header() const;
+    void resume_checkpoint(frame_buffer& frame);
+    void write_checkpoint(const frame_buffer& frame) const;
+    void wait_checkpointing(std::future<void>& future, const frame_buffer& frame) const;
+    void render_fixed(const entity& world, const entity& lights, frame_buffer& frame,
+                      thread_pool_ws& thread_pool, std::atomic<size_t>& shading_allocations) const;
+    void render_adaptive(const entity& world, const entity& lights, frame_buffer& frame,
+                         thread_pool_ws& thread_pool, std::atomic<size_t>& shading_allocations) const;
+    void render_timed(const entity& world, const entity& lights, frame_buffer& frame, thread_pool_ws& thread_pool,
+                      std::atomic<size_t>& shading_allocations, std::chrono::steady_clock::time_point deadline) const;
+    ray get_ray(int i, int j) const;
     vec3 pixel_sample_square() const;
-    vec3 sample_square_stratified(int sample_i, int sample_j) const;
     vec3 pixel_sample_disk(float radius) const;
     point3 defocus_disk_sample() const;
     color ray_color(const ray& r, int depth, const entity& world, const entity& lights) const;
@@ -177,7 +202,6 @@ inline void camera::initialize() {
 
     sqrt_samples_per_pixel = static_cast<int>( std::sqrt( samples_per_pixel ) );
     pixel_samples_scale = 1.0f / static_cast<float>( sqrt_samples_per_pixel );
-    recip_sqrt_samples_per_pixel = 1.0f / static_cast<float>( sqrt_samples_per_pixel );
 
     center = lookfrom;
 
@@ -205,9 +229,364 @@ inline void camera::initialize() {
 
 }
 
-inline ray camera::get_ray(int i, int j, int sample_i, int sample_j) const
+// Every pixel gets samples_per_pixel samples, one task per tile renders all of them. Resumed pixels skip the samples
+// they already have.
+inline void camera::render_fixed(const entity& world, const entity& lights, frame_buffer& frame,
+                                 thread_pool_ws& thread_pool, std::atomic<size_t>& shading_allocations) const {
+    const int total_tiles{ frame.tile_count() };
+    std::vector<std::future<void>> futures;
+
+    for (int tile_index{}; tile_index < total_tiles; ++tile_index) {
+        auto future = thread_pool.submit([this, &world, &lights, &frame, &shading_allocations, tile_index]() {
+
+            const int x_begin{ frame.tile_x_begin(tile_index) };
+            const int y_begin{ frame.tile_y_begin(tile_index) };
+            const int x_end{ frame.tile_x_end(tile_index) };
+            const int y_end{ frame.tile_y_end(tile_index) };
+
+            tile_accumulator local{};
+            frame.read_tile(tile_index, local);
+            const size_t allocations_before{ thread_allocation_count() };
+
+            int first_sample{ sqrt_samples_per_pixel * sqrt_samples_per_pixel };
+            for (int y{ y_begin }; y < y_end; ++y)
+                for (int x{ x_begin }; x < x_end; ++x)
+                    first_sample = std::min(first_sample, local[(y - y_begin) * tile_size + (x - x_begin)].samples);
+
+            // Render pixels in tile
+            // Edited to sample every pixel in tile once and again
+            // until rendered; not rendering one pixel fully then going to next pixel (it looks nicer in preview imo)
+            for (int sample_index{ first_sample }; sample_index < sqrt_samples_per_pixel * sqrt_samples_per_pixel; ++sample_index) {
+                for (int y{ y_begin }; y < y_end; ++y) {
+                    for (int x{ x_begin }; x < x_end; ++x) {
+
+                        pixel_accumulator& pixel{ local[(y - y_begin) * tile_size + (x - x_begin)] };
+                        if (pixel.samples != sample_index)
+                            continue;
+
+                        begin_sample_random(random_seed, y * image_width + x, sample_index, sampler);
+
+                        ray r{ get_ray(x, y) };
+                        color sample_color = ray_color(r, max_depth, world, lights);
+
+                        const float sample_luminance{ luminance(sample_color) };
+                        pixel.sum += sample_color;
+                        pixel.luminance_squared_sum += sample_luminance * sample_luminance;
+                        ++pixel.samples;
+                    }
+                }
+
+                // Pass boundary, make this pass visible to the preview
+                frame.publish(tile_index, local);
+            } // my sampling more like 3D softwares uses
+
+            shading_allocations += thread_allocation_count() - allocations_before;
+
+        });
+
+        futures.push_back(std::move(future));
+    }
+
+    int completed_tiles{ 0 };
+    for (auto& future: futures) {
+        wait_checkpointing(future, frame);
+        ++completed_tiles;
+        std::clog << "\rCompleted " << completed_tiles << "/" << total_tiles
+        << " tiles (" << (completed_tiles * 100 / total_tiles) << "%)" << std::flush;
+    }
+    std::clog << "\n";
+}
+
+// Rounds over the whole frame: every pixel still above the threshold doubles its sample count, one task per tile
+// that still has work. Pixel states are only updated between rounds on this thread and decisions depend on the
+// accumulated samples alone, so a seed still renders the same image with any number of threads.
+inline void camera::render_adaptive(const entity& world, const entity& lights, frame_buffer& frame,
+                                    thread_pool_ws& thread_pool, std::atomic<size_t>& shading_allocations) const {
+    const int total_tiles{ frame.tile_count() };
+    const size_t pixel_count{ static_cast<size_t>(image_width) * image_height };
+    const int max_samples{ adaptive_max_samples > 0 ? adaptive_max_samples : 8 * samples_per_pixel };
+    const int min_samples{ std::clamp(adaptive_min_samples, 1, std::min(samples_per_pixel, max_samples)) };
+    const uint64_t budget{ static_cast<uint64_t>(samples_per_pixel) * pixel_count };
+
+    // Kept across rounds, a tile's accumulator is only touched by the task rendering that tile
+    std::vector<tile_accumulator> accumulators(total_tiles);
+    // Samples each pixel takes in the coming round (row major), 0 once it stopped.
+    // The first round tops every pixel up to min_samples, resumed samples count against the budget.
+    std::vector<int> round_samples(pixel_count);
+    uint64_t spent{ 0 };
+    for (int tile_index{}; tile_index < total_tiles; ++tile_index) {
+        frame.read_tile(tile_index, accumulators[tile_index]);
+        for (int y{ frame.tile_y_begin(tile_index) }; y < frame.tile_y_end(tile_index); ++y) {
+            for (int x{ frame.tile_x_begin(tile_index) }; x < frame.tile_x_end(tile_index); ++x) {
+                const int samples{ accumulators[tile_index][(y - frame.tile_y_begin(tile_index)) * tile_size + (x - frame.tile_x_begin(tile_index))].samples };
+                round_samples[y * image_width + x] = std::max(min_samples - samples, 0);
+                spent += std::max(samples, min_samples);
+            }
+        }
+    }
+
+    struct noisy_pixel {
+        float error;
+        uint32_t index;
+    };
+    std::vector<noisy_pixel> noisy;
+    std::vector<float> errors(pixel_count);
+    std::vector<int> sample_counts(pixel_count);
+
+    for (int round{ 0 }; ; ++round) {
+        std::vector<std::future<void>> futures;
+
+        for (int tile_index{}; tile_index < total_tiles; ++tile_index) {
+            auto future = thread_pool.submit([this, &world, &lights, &frame, &shading_allocations, &accumulators, &round_samples, tile_index]() {
+
+                const int x_begin{ frame.tile_x_begin(tile_index) };
+                const int y_begin{ frame.tile_y_begin(tile_index) };
+                const int x_end{ frame.tile_x_end(tile_index) };
+                const int y_end{ frame.tile_y_end(tile_index) };
+
+                tile_accumulator& local{ accumulators[tile_index] };
+                const size_t allocations_before{ thread_allocation_count() };
+
+                // One sample for every pixel still owed one per pass, so the preview fills the tile evenly.
+                // Sample indices continue where the pixel stopped, the random numbers match a fixed render.
+                for (int pass{ 0 }; ; ++pass) {
+                    bool sampled{ false };
+
+                    for (int y{ y_begin }; y < y_end; ++y) {
+                        for (int x{ x_begin }; x < x_end; ++x) {
+                            const int pixel_index{ y * image_width + x };
+                            if (pass >= round_samples[pixel_index])
+                                continue;
+
+                            pixel_accumulator& pixel{ local[(y - y_begin) * tile_size + (x - x_begin)] };
+                            const int sample_index{ pixel.samples };
+                            begin_sample_random(random_seed, pixel_index, sample_index, sampler);
+
+                            ray r{ get_ray(x, y) };
+                            const color sample_color{ ray_color(r, max_depth, world, lights) };
+
+                            const float sample_luminance{ luminance(sample_color) };
+                            pixel.sum += sample_color;
+                            pixel.luminance_squared_sum += sample_luminance * sample_luminance;
+                            ++pixel.samples;
+                            sampled = true;
+                        }
+                    }
+
+                    if (!sampled)
+                        break;
+
+                    frame.publish(tile_index, local);
+                }
+
+                shading_allocations += thread_allocation_count() - allocations_before;
+            });
+
+            futures.push_back(std::move(future));
+        }
+
+        for (auto& future : futures)
+            wait_checkpointing(future, frame);
+
+        // Per pixel error first, row major so the neighbourhood below is simple indexing
+        for (int tile_index{}; tile_index < total_tiles; ++tile_index) {
+            const int x_begin{ frame.tile_x_begin(tile_index) };
+            const int y_begin{ frame.tile_y_begin(tile_index) };
+            for (int y{ y_begin }; y < frame.tile_y_end(tile_index); ++y) {
+                for (int x{ x_begin }; x < frame.tile_x_end(tile_index); ++x) {
+                    const pixel_accumulator& pixel{ accumulators[tile_index][(y - y_begin) * tile_size + (x - x_begin)] };
+                    errors[y * image_width + x] = displayed_standard_error(pixel);
+                    sample_counts[y * image_width + x] = pixel.samples;
+                }
+            }
+        }
+
+        // Next round: converged or capped pixels stop, the others ask for as many samples as they already have.
+        // A pixel is judged by the worst error around it: one that missed the rare bright paths its neighbours
+        // found looks converged on its own samples, and stopping it there would darken the image.
+        noisy.clear();
+        uint64_t requested{ 0 };
+        for (int y{ 0 }; y < image_height; ++y) {
+            for (int x{ 0 }; x < image_width; ++x) {
+                const int pixel_index{ y * image_width + x };
+
+                float error{ 0.f };
+                for (int ny{ std::max(y - 1, 0) }; ny <= std::min(y + 1, image_height - 1); ++ny)
+                    for (int nx{ std::max(x - 1, 0) }; nx <= std::min(x + 1, image_width - 1); ++nx)
+                        error = std::max(error, errors[ny * image_width + nx]);
+
+                const int samples{ sample_counts[pixel_index] };
+                if (samples >= max_samples || error <= adaptive_threshold) {
+                    round_samples[pixel_index] = 0;
+                    continue;
+                }
+
+                round_samples[pixel_index] = std::min(samples, max_samples - samples);
+                requested += round_samples[pixel_index];
+                noisy.push_back(noisy_pixel{ error, static_cast<uint32_t>(pixel_index) });
+            }
+        }
+
+        std::clog << "\rAdaptive round " << round + 1 << ": " << noisy.size() << " of " << pixel_count
+            << " pixels still noisy, " << spent * 100 / budget << "% of the budget spent" << std::flush;
+
+        const uint64_t remaining{ spent < budget ? budget - spent : 0 };
+        if (requested == 0 || remaining == 0)
+            break;
+
+        // Not enough left for everyone, the noisiest pixels are served first
+        if (requested > remaining) {
+            std::sort(noisy.begin(), noisy.end(), [](const noisy_pixel& a, const noisy_pixel& b) {
+                return a.error != b.error ? a.error > b.error : a.index < b.index;
+            });
+
+            uint64_t left{ remaining };
+            for (const noisy_pixel& pixel : noisy) {
+                const uint64_t granted{ std::min<uint64_t>(round_samples[pixel.index], left) };
+                round_samples[pixel.index] = static_cast<int>(granted);
+                left -= granted;
+            }
+            requested = remaining;
+        }
+
+        spent += requested;
+    }
+
+    std::clog << "\nAdaptive sampling: " << std::format("{:.1f}", static_cast<double>(spent) / pixel_count)
+        << " samples per pixel on average, " << pixel_count - noisy.size() << " of " << pixel_count << " pixels converged or capped\n";
+}
+
+// Full frame passes until the deadline, so the whole image sharpens together and stopping at any moment leaves
+// every pixel with nearly the same sample count. Tiles check the clock once per row and publish what they have,
+// the image is resolved with each pixel's own count.
+inline void camera::render_timed(const entity& world, const entity& lights, frame_buffer& frame, thread_pool_ws& thread_pool,
+                                 std::atomic<size_t>& shading_allocations, std::chrono::steady_clock::time_point deadline) const {
+    const int total_tiles{ frame.tile_count() };
+    std::vector<tile_accumulator> accumulators(total_tiles);
+    for (int tile_index{}; tile_index < total_tiles; ++tile_index)
+        frame.read_tile(tile_index, accumulators[tile_index]);
+    std::atomic<bool> expired{ false };
+
+    int pass{ 0 };
+    for (; !expired; ++pass) {
+        std::vector<std::future<void>> futures;
+
+        for (int tile_index{}; tile_index < total_tiles; ++tile_index) {
+            auto future = thread_pool.submit([this, &world, &lights, &frame, &shading_allocations, &accumulators, &expired, deadline, tile_index]() {
+
+                const int x_begin{ frame.tile_x_begin(tile_index) };
+                const int y_begin{ frame.tile_y_begin(tile_index) };
+                const int x_end{ frame.tile_x_end(tile_index) };
+                const int y_end{ frame.tile_y_end(tile_index) };
+
+                tile_accumulator& local{ accumulators[tile_index] };
+                const size_t allocations_before{ thread_allocation_count() };
+
+                for (int y{ y_begin }; y < y_end; ++y) {
+                    if (expired || std::chrono::steady_clock::now() >= deadline) {
+                        expired = true;
+                        break;
+                    }
+
+                    for (int x{ x_begin }; x < x_end; ++x) {
+                        pixel_accumulator& pixel{ local[(y - y_begin) * tile_size + (x - x_begin)] };
+                        const int sample_index{ pixel.samples };
+                        begin_sample_random(random_seed, y * image_width + x, sample_index, sampler);
+
+                        ray r{ get_ray(x, y) };
+                        color sample_color = ray_color(r, max_depth, world, lights);
+
+                        const float sample_luminance{ luminance(sample_color) };
+                        pixel.sum += sample_color;
+                        pixel.luminance_squared_sum += sample_luminance * sample_luminance;
+                        ++pixel.samples;
+                    }
+                }
+
+                frame.publish(tile_index, local);
+                shading_allocations += thread_allocation_count() - allocations_before;
+            });
+
+            futures.push_back(std::move(future));
+        }
+
+        for (auto& future : futures)
+            wait_checkpointing(future, frame);
+
+        if (!expired)
+            std::clog << "\rCompleted " << pass + 1 << " passes" << std::flush;
+    }
+
+    std::clog << "\nTime budget spent after " << pass - 1 << " full passes\n";
+}
+
+// What this render writes in front of its pixels, and what a checkpoint has to match to be resumed
+inline accumulation camera::checkpoint_header() const {
+    accumulation header{};
+    header.width = image_width;
+    header.height = image_height;
+    header.samples_per_pixel = samples_per_pixel;
+    header.max_depth = max_depth;
+    header.sampler = static_cast<uint32_t>(sampler);
+    header.scene = scene_name;
+    header.seeds = checkpoint_seeds;
+    return header;
+}
+
+// Loads the checkpoint into the frame before any worker starts. A file written by another setup is somebody
+// else's render, it is left alone.
+inline void camera::resume_checkpoint(frame_buffer& frame) {
+    accumulation resumed;
+    if (!load_accumulation(checkpoint_file, resumed))
+        throw std::runtime_error("Cannot resume from checkpoint " + checkpoint_file);
+
+    const std::string mismatch{ accumulation_mismatch(resumed, checkpoint_header(), true) };
+    if (!mismatch.empty())
+        throw std::runtime_error("Checkpoint " + checkpoint_file + " was written by another render: " + mismatch);
+
+    checkpoint_seeds = resumed.seeds;
+    if (std::find(checkpoint_seeds.begin(), checkpoint_seeds.end(), random_seed) == checkpoint_seeds.end())
+        checkpoint_seeds.push_back(random_seed);
+
+    uint64_t total_samples{ 0 };
+    tile_accumulator tile{};
+    for (int tile_index{}; tile_index < frame.tile_count(); ++tile_index) {
+        for (int y{ frame.tile_y_begin(tile_index) }; y < frame.tile_y_end(tile_index); ++y) {
+            for (int x{ frame.tile_x_begin(tile_index) }; x < frame.tile_x_end(tile_index); ++x) {
+                const pixel_accumulator& pixel{ resumed.pixels[y * image_width + x] };
+                tile[(y - frame.tile_y_begin(tile_index)) * tile_size + (x - frame.tile_x_begin(tile_index))] = pixel;
+                total_samples += pixel.samples;
+            }
+        }
+        frame.publish(tile_index, tile);
+    }
+
+    std::clog << "Resumed " << checkpoint_file << ", " << total_samples / resumed.pixels.size()
+        << " samples per pixel on average\n";
+}
+
+// Published tiles only, so a checkpoint written mid pass still pairs every pixel sum with its own sample count
+inline void camera::write_checkpoint(const frame_buffer& frame) const {
+    accumulation checkpoint{ checkpoint_header() };
+    checkpoint.pixels = frame.resolve();
+    save_accumulation(checkpoint_file, checkpoint);
+    last_checkpoint = std::chrono::steady_clock::now();
+}
+
+inline void camera::wait_checkpointing(std::future<void>& future, const frame_buffer& frame) const {
+    if (checkpoint_file.empty()) {
+        future.wait();
+        return;
+    }
+
+    const auto interval{ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(checkpoint_interval)) };
+    while (future.wait_until(last_checkpoint + interval) != std::future_status::ready)
+        write_checkpoint(frame);
+}
+
+// Pixel position, lens and time are the sample's first dimensions, the sampler stratifies them across the pixel's samples
+inline ray camera::get_ray(int i, int j) const
 {
-    auto offset{ sample_square_stratified(sample_i, sample_j) };
     auto pixel_center{ pixel00_loc + ( i * pixel_delta_u ) + ( j * pixel_delta_v ) };
     auto pixel_sample{ pixel_center + pixel_sample_square() };
 
@@ -225,13 +604,6 @@ inline vec3 camera::pixel_sample_square() const
     return ( px * pixel_delta_u ) + ( py * pixel_delta_v );
 }
 
-inline vec3 camera::sample_square_stratified(int sample_i, int sample_j) const
-{
-    auto px{ ( sample_i + random_float() ) * recip_sqrt_samples_per_pixel - 0.5f };
-    auto py{ ( sample_j + random_float() ) * recip_sqrt_samples_per_pixel - 0.5f };
-    return vec3( px, py, 0.f );
-}
-
 inline vec3 camera::pixel_sample_disk(float radius) const
 {
     auto p{ radius * random_in_unit_disk() };
@@ -244,35 +616,109 @@ inline point3 camera::defocus_disk_sample() const
     return center + ( p[0] * defocus_disk_u ) + ( p[1] * defocus_disk_v );
 }
 
-inline color camera::ray_color(const ray &r, int depth, const entity &world, const entity& lights) const
+inline color camera::ray_color(const ray &r_in, int depth, const entity &world, const entity& lights) const
 {
-    if (depth <= 0)
-        return color{ 0.f, 0.f, 0.f };
-    
-    hit_record rec{};
+    // Iterative path tracer: one stack frame for the whole path, throughput carries what the recursion used to multiply
+    // on the way back up. depth (max_depth) is only a hard cap, russian roulette ends most paths well before it.
+    color radiance{ 0.f, 0.f, 0.f };
+    color throughput{ 1.f, 1.f, 1.f };
+    ray r{ r_in };
 
-    if (!world.hit(r, interval(0.001f, infinity), rec))
-        return background;
+    // Material pdf of the direction r was sampled with, 0 after the camera and specular bounces: no light sample
+    // could have produced those directions, so emitters they hit count fully
+    float scatter_pdf_value{ 0.f };
 
-    scatter_record srec{};
-    color color_from_emission{ rec.mat->emitted(r, rec,rec.u, rec.v, rec.p) };
+    for (int bounce{ 0 }; bounce < depth; ++bounce) {
+        begin_bounce_random(bounce);
 
-    if (!rec.mat->scatter( r, rec, srec))
-        return color_from_emission;
+        hit_record rec{};
 
-    if (srec.skip_pdf)
-        return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
+        if (!world.hit(r, interval(0.001f, infinity), rec)) {
+            radiance += throughput * background;
+            break;
+        }
 
-    auto light_ptr{ std::make_shared<entity_pdf>(lights, rec.p) };
-    mixture_pdf p{ light_ptr, srec.pdf_ptr };
+        scatter_record srec{};
+        color emitted{ rec.mat->emitted(r, rec, rec.u, rec.v, rec.p) };
+        if (integrator == integrator_mode::nee_mis && scatter_pdf_value > 0.f && !emitted.near_zero())
+            emitted *= power_heuristic(scatter_pdf_value, lights.emitter_pdf_value(r.origin(), r.direction()));
+        radiance += throughput * emitted;
+
+        if (!rec.mat->scatter(r, rec, srec))
+            break;
+
+        if (srec.skip_pdf) {
+            throughput *= srec.attenuation;
+            r = srec.skip_pdf_ray;
+            scatter_pdf_value = 0.f;
+        } else if (!sample_lights) {
+            const pdf& material_pdf{ srec.scatter_pdf() };
+            ray scattered{ rec.p, material_pdf.generate(), r.time() };
+            scatter_pdf_value = material_pdf.value(scattered.direction());
+            if (scatter_pdf_value <= 0.f)
+                break;
+
+            throughput *= srec.attenuation * rec.mat->scattering_pdf(r, rec, scattered) / scatter_pdf_value;
+            r = scattered;
+        } else if (integrator == integrator_mode::nee_mis) {
+            const pdf& material_pdf{ srec.scatter_pdf() };
+
+            // Light sample, it already knows the point and its radiance so only visibility is traced, stopping
+            // just short of the light at t = 1. Lights behind the surface are skipped before tracing anything.
+            light_sample sample{};
+            if (lights.sample_light(rec.p, sample) && !sample.emitted.near_zero()) {
+                const ray to_light{ rec.p, sample.direction, r.time() };
+                const float scattering_pdf{ rec.mat->scattering_pdf(r, rec, to_light) };
+                if (scattering_pdf > 0.f && !world.occluded(to_light, interval(0.001f, 1.f - 0.001f / sample.distance))) {
+                    const float weight{ power_heuristic(sample.emitter_pdf, material_pdf.value(sample.direction)) };
+                    radiance += throughput * srec.attenuation * sample.emitted * (scattering_pdf * weight / sample.emitter_pdf);
+                }
+            }
 
-    ray scattered{ ray(rec.p, p.generate(), r.time()) };
-    auto pdf_value{ p.value(scattered.direction()) };
+            // Material sample continues the path, its hit on an emitter gets the other half of the weights
+            ray scattered{ rec.p, material_pdf.generate(), r.time() };
+            scatter_pdf_value = material_pdf.value(scattered.direction());
+            if (scatter_pdf_value <= 0.f)
+                break;
+
+            throughput *= srec.attenuation * rec.mat->scattering_pdf(r, rec, scattered) / scatter_pdf_value;
+            r = scattered;
+        } else {
+            // 50/50 mixture of the lights and the material. Whichever picked the direction, the path goes on to
+            // whatever it hits, so the lights' density is the sum over every light the direction reaches.
+            // When no light can be sampled the light half contributes nothing, the material half alone still
+            // integrates everything.
+            const pdf& material_pdf{ srec.scatter_pdf() };
+            ray scattered{};
+            if (random_float() < 0.5f) {
+                light_sample sample{};
+                if (!lights.sample_light(rec.p, sample))
+                    break;
+                scattered = ray(rec.p, sample.direction, r.time());
+            } else {
+                scattered = ray(rec.p, material_pdf.generate(), r.time());
+            }
+
+            const float light_pdf_value{ lights.pdf_value(rec.p, scattered.direction()) };
+            const float pdf_value{ 0.5f * material_pdf.value(scattered.direction()) + 0.5f * light_pdf_value };
+            const float scattering_pdf{ rec.mat->scattering_pdf(r, rec, scattered) };
+            if (scattering_pdf <= 0.f)
+                break; // light sample below the surface, nothing more can arrive along this path
+
+            throughput *= srec.attenuation * scattering_pdf / pdf_value;
+            r = scattered;
+        }
 
-    auto scattering_pdf{ rec.mat->scattering_pdf( r, rec, scattered ) };
+        // Russian roulette, survivors are reweighted so the estimate stays unbiased
+        if (bounce >= russian_roulette_depth) {
+            float survival_probability{ std::fmin(std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())), 0.95f) };
 
-    color sample_color{ ray_color(scattered, depth - 1, world, lights) };
-    color color_from_scatter{ (srec.attenuation * scattering_pdf * sample_color) / pdf_value };
+            if (random_float() >= survival_probability)
+                break;
+
+            throughput /= survival_probability;
+        }
+    }
 
-    return color_from_emission + color_from_scatter;
+    return radiance;
 }
@@ -0,0 +1,140 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// iclude order matters, same as scenes.hpp
+#include "camera.hpp"
+#include "accumulation_file.hpp"
+#include "entitylist.hpp"
+#include "material.hpp"
+#include "quad.hpp"
+#include "sphere.hpp"
+
+// Checkpoints have to carry a render on exactly: a half finished render resumed to the full sample count must be
+// bit identical to one rendered in one go, merged parts have to add up, and files of another setup are refused.
+auto check(bool passed, const char* name) -> int
+{
+    std::cout << name << (passed ? ": ok\n" : ": FAILED\n");
+    return passed ? 0 : 1;
+}
+
+auto read_bytes(const std::string& filename) -> std::string
+{
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+auto same_pixels(const accumulation& a, const accumulation& b) -> bool
+{
+    if (a.pixels.size() != b.pixels.size())
+        return false;
+    for (size_t i{ 0 }; i < a.pixels.size(); ++i)
+    {
+        const pixel_accumulator& pa{ a.pixels[i] };
+        const pixel_accumulator& pb{ b.pixels[i] };
+        if (pa.samples != pb.samples || pa.luminance_squared_sum != pb.luminance_squared_sum
+            || pa.sum.x() != pb.sum.x() || pa.sum.y() != pb.sum.y() || pa.sum.z() != pb.sum.z())
+            return false;
+    }
+    return true;
+}
+
+auto render(const entity& world, uint32_t seed, int samples_per_pixel, const std::string& checkpoint_file
+    , const std::string& scene_name = "checkpoint check") -> accumulation
+{
+    camera cam;
+    cam.image_width = 32;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth = 8;
+    cam.random_seed = seed;
+    cam.integrator = integrator_mode::nee_mis;
+    cam.lookfrom = point3(0.f, 1.f, -4.f);
+    cam.lookat = point3(0.f, 0.f, 0.f);
+    cam.vfov = 40.f;
+    cam.checkpoint_file = checkpoint_file;
+    cam.scene_name = scene_name;
+    cam.render(world);
+
+    accumulation result;
+    load_accumulation(checkpoint_file, result);
+    return result;
+}
+
+auto main() -> int
+{
+    entity_list world;
+    world.add(std::make_shared<sphere>(point3(0.f, 0.f, 0.f), 1.f, std::make_shared<lambertian>(color(.7f, .3f, .2f))));
+    world.add(std::make_shared<quad>(point3(-1.f, 3.f, -1.f), vec3(2.f, 0.f, 0.f), vec3(0.f, 0.f, 2.f)
+        , std::make_shared<diffuse_light>(color(4.f, 4.f, 4.f))));
+
+    const std::string full_file{ "checkpoint_check_full.acc" };
+    const std::string resumed_file{ "checkpoint_check_resumed.acc" };
+    const std::string other_file{ "checkpoint_check_other.acc" };
+    const std::string merged_file{ "checkpoint_check_merged.acc" };
+    for (const std::string& filename : { full_file, resumed_file, other_file, merged_file })
+        std::remove(filename.c_str());
+
+    int failures{ 0 };
+
+    // Save and load give back the same accumulation
+    const accumulation full{ render(world, 1, 8, full_file) };
+    accumulation loaded;
+    failures += check(load_accumulation(full_file, loaded) && save_accumulation(merged_file, loaded)
+        && read_bytes(merged_file) == read_bytes(full_file), "save and load round trip");
+    std::remove(merged_file.c_str());
+
+    // Half the samples, then resumed to the full count with the same seed
+    accumulation half{ render(world, 1, 4, resumed_file) };
+    half.samples_per_pixel = 8;
+    save_accumulation(resumed_file, half);
+    const accumulation resumed{ render(world, 1, 8, resumed_file) };
+    failures += check(same_pixels(resumed, full) && resumed.seeds == full.seeds, "resume matches a render in one go");
+
+    // Another seed's part adds up, the same seed twice is refused
+    const accumulation other{ render(world, 2, 8, other_file) };
+    accumulation merged{ full };
+    bool sums_match{ merge_accumulation(merged, other) && merged.samples_per_pixel == 16 };
+    for (size_t i{ 0 }; sums_match && i < merged.pixels.size(); ++i)
+        sums_match = merged.pixels[i].samples == full.pixels[i].samples + other.pixels[i].samples;
+    failures += check(sums_match, "merge of two seeds");
+
+    accumulation twice{ full };
+    failures += check(!merge_accumulation(twice, full), "merge refuses a seed twice");
+
+    // A checkpoint of another setup is refused and left alone
+    const std::string before{ read_bytes(full_file) };
+    bool refused{ false };
+    try
+    {
+        render(world, 1, 8, full_file, "another scene");
+    }
+    catch (const std::runtime_error&)
+    {
+        refused = true;
+    }
+    failures += check(refused && read_bytes(full_file) == before, "resume refuses another scene's checkpoint");
+
+    accumulation deeper{ full };
+    deeper.max_depth = 16;
+    accumulation merge_target{ full };
+    failures += check(!merge_accumulation(merge_target, deeper), "merge refuses another max_depth");
+
+    // Not an accumulation file at all
+    {
+        std::ofstream garbage(merged_file, std::ios::binary);
+        garbage << "not a checkpoint";
+    }
+    accumulation ignored;
+    failures += check(!load_accumulation(merged_file, ignored), "load refuses a foreign file");
+
+    for (const std::string& filename : { full_file, resumed_file, other_file, merged_file })
+        std::remove(filename.c_str());
+
+    return failures == 0 ? 0 : 1;
+}
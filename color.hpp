@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include "interval.hpp"
@@ -6,6 +8,31 @@
 
 using color = vec3;
 
+#pragma region pixel accumulator
+struct pixel_accumulator {
+    color sum{ 0.f, 0.f, 0.f };
+    int samples{};
+    float luminance_squared_sum{}; // variance estimate for adaptive sampling, kept by every mode so renders resume in any
+};
+#pragma endregion
+
+// Rec. 709 weights, used to rank emitters by brightness
+__forceinline float luminance(const color& c) {
+    return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+}
+
+// Standard error of the pixel's mean luminance carried through the gamma 2 output curve, roughly how far the
+// written value is from converged (1 is full scale). The floor keeps black pixels from dividing by zero.
+__forceinline float displayed_standard_error(const pixel_accumulator& pixel) {
+    if (pixel.samples < 2)
+        return infinity;
+
+    const float n{ static_cast<float>(pixel.samples) };
+    const float mean{ luminance(pixel.sum) / n };
+    const float variance{ std::fmax(0.f, (pixel.luminance_squared_sum / n - mean * mean) * n / (n - 1.f)) };
+    return std::sqrt(variance / n) / (2.f * std::sqrt(std::fmax(mean, 1e-4f)));
+}
+
 __forceinline float linear_to_gamma(float linear_component) {
     if (linear_component > 0.f)
         return std::sqrt(linear_component);
@@ -41,8 +68,8 @@ void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
         << static_cast<int>(256 * intensity.clamp(b)) << '\n';
 }
 
-void save_ppm_binary(const std::string& filename, const std::vector<color>& frame_buffer,
-    int image_width, int image_height, int samples_per_pixel) {
+void save_ppm_binary(const std::string& filename, const std::vector<pixel_accumulator>& pixels,
+    int image_width, int image_height) {
     // Open file in binary mode
     std::ofstream file(filename, std::ios::binary);
     if (!file) {
@@ -61,10 +88,11 @@ void save_ppm_binary(const std::string& filename, const std::vector<color>& fram
     // Fill the buffer with pixel data
     for (int j = 0; j < image_height; ++j) {
         for (int i = 0; i < image_width; ++i) {
-            const color& pixel_color = frame_buffer[j * image_width + i];
+            const pixel_accumulator& pixel = pixels[j * image_width + i];
+            const color& pixel_color = pixel.sum;
 
-            // Apply scaling and gamma correction
-            float scale = 1.0f / samples_per_pixel;
+            // Apply scaling by the samples this pixel actually received and gamma correction
+            float scale = pixel.samples > 0 ? 1.0f / pixel.samples : 0.f;
             float r{ linear_to_gamma(pixel_color.x() * scale) };
             float g{ linear_to_gamma(pixel_color.y() * scale) };
             float b{ linear_to_gamma(pixel_color.z() * scale) };
@@ -89,4 +117,35 @@ void save_ppm_binary(const std::string& filename, const std::vector<color>& fram
     file.close();
 
     std::cout << "Binary PPM file saved: " << filename << std::endl;
-}
\ No newline at end of file
+}
+
+// Samples each pixel received, as grey levels relative to the most sampled pixel
+void save_convergence_map(const std::string& filename, const std::vector<pixel_accumulator>& pixels,
+    int image_width, int image_height) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open file: " << filename << std::endl;
+        return;
+    }
+
+    int max_samples{ 1 };
+    for (const pixel_accumulator& pixel : pixels)
+        max_samples = std::max(max_samples, pixel.samples);
+
+    std::string header = "P6\n" + std::to_string(image_width) + " " +
+            std::to_string(image_height) + "\n255\n";
+    file.write(header.c_str(), header.length());
+
+    std::vector<unsigned char> buffer(image_width * image_height * 3);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        const unsigned char level = static_cast<unsigned char>(255.f * pixels[i].samples / max_samples);
+        buffer[i * 3 + 0] = level;
+        buffer[i * 3 + 1] = level;
+        buffer[i * 3 + 2] = level;
+    }
+
+    file.write(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    file.close();
+
+    std::cout << "Convergence map saved: " << filename << " (white = " << max_samples << " samples)" << std::endl;
+}
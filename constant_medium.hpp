@@ -26,13 +26,14 @@ public:
         , phase_function{ std::make_shared<isotropic>(albedo) }
         {}
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
         hit_record rec1, rec2;
 
-        if (!boundary->hit(r, interval::universe, rec1))
+        // Only the entry and exit distances are needed, skip the boundary's surface attributes
+        if (!boundary->intersect(r, interval::universe, rec1))
             return false;
         
-        if (!boundary->hit(r, interval{rec1.t + 0.000'1f, infinity}, rec2))
+        if (!boundary->intersect(r, interval{rec1.t + 0.000'1f, infinity}, rec2))
             return false;
         
         if (rec1.t < ray_t.min) rec1.t = ray_t.min;
@@ -56,11 +57,14 @@ public:
 
         rec.normal = vec3(1.f,0.f,0.f);  // arbitrary
         rec.front_face = true;           // also arbitrary
-        rec.mat = phase_function;
+        rec.mat = phase_function.get();
+        rec.object = this;
 
         return true;
     }
 
     aabb bounding_box() const override { return boundary->bounding_box(); }
+
+    aabb bounding_box_at(float time) const override { return boundary->bounding_box_at(time); }
 };
 #pragma endregion
\ No newline at end of file
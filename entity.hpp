@@ -1,16 +1,53 @@
 #pragma once
 #include "aabb.hpp"
+#include "affine.hpp"
+#include "color.hpp"
 #include "ray.hpp"
 #include "rtweekend.hpp"
 
+#include <vector>
+
 
 class material;
+class entity;
+
+#pragma region emitter record
+// Emissive primitive found in the scene graph. The object is owned by the scene and stays in its own space,
+// object_to_world places it. Bounds, power and the orientation cone are world space and only steer sampling.
+struct emitter {
+    const entity* object{ nullptr };
+    affine3 object_to_world{};
+    affine3 world_to_object{};
+    bool transformed{ false };
+    aabb bounds;
+    float power{};              // luminance times area, relative only
+    vec3 axis{ 0.f, 0.f, 1.f }; // surface normals lie within theta_o of axis,
+    float cos_theta_o{ 1.f };   // and light leaves within theta_e of a normal
+    float cos_theta_e{ 0.f };
+};
+#pragma endregion
+
+#pragma region light sample
+// A point picked on an emitter as seen from origin, with everything needed to use it without tracing the light.
+// direction runs from origin to the point so the light sits at t = 1, distance is its length, pdf is the density
+// of direction per unit solid angle, the same value pdf_value returns for it (aggregates sum over every light the
+// direction passes through), emitter_pdf is the odds of picking this light times its own density, the one the
+// point was drawn with, and emitted is the radiance the point sends back towards origin.
+struct light_sample {
+    vec3 direction{};
+    float distance{};
+    float pdf{};
+    float emitter_pdf{};
+    color emitted{};
+};
+#pragma endregion
 
 #pragma region declaration of hit record
 struct hit_record {
     point3 p{};
     vec3 normal{};
-    std::shared_ptr<material> mat;
+    const material* mat{ nullptr }; // owned by the entity that was hit, which outlives the render
+    const entity* object{ nullptr }; // set by intersect, completes the record in surface_interaction
     float t{};
     float u{};
     float v{};
@@ -29,121 +66,69 @@ public:
 
     virtual ~entity() = default;
 
-    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
-
-    virtual aabb bounding_box() const = 0;
-
-    virtual float pdf_value(const point3& origin, const vec3& direction) const { return 0.f; }
-
-    virtual vec3 random(const point3& origin) const { return vec3(1, 0, 0); }
-};
-#pragma endregion
-
-#pragma region translation/rotation object dec
-class translate : public entity {
-
-    std::shared_ptr<entity> object;
-    vec3 offset;
-    aabb bbox;
-
-public:
-
-    translate(std::shared_ptr<entity> object, const vec3& offset)
-    : object{object}, offset{offset} {
-        bbox = object->bounding_box() + offset;
-    }
-
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        ray offset_r{r.origin() - offset, r.direction(), r.time()};
-
-        if (!object->hit(offset_r, ray_t, rec))
-            return false; 
-
-        rec.p += offset;
+    // Closest hit with every surface attribute filled in
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        if (!intersect(r, ray_t, rec))
+            return false;
 
+        rec.object->surface_interaction(r, rec);
         return true;
-    };
-
-    aabb bounding_box() const override { return bbox; }
-};
-#pragma endregion
-
-#pragma region Y Rotation 
-class rotate_y : public entity {
-
-    std::shared_ptr<entity> object;
-    float sin_theta{};
-    float cos_theta{};
-    aabb bbox{};
-
-public:
-
-    rotate_y(std::shared_ptr<entity> object, float angle) : object{object} {
-        auto randians{ degrees_to_radians(angle) };
-        sin_theta = std::sin(randians);
-        cos_theta = std::cos(randians);
-        bbox = object->bounding_box();
-
-        point3 min{ infinity,  infinity,  infinity };
-        point3 max{ -infinity, -infinity, -infinity };
-
-        for (int i{}; i < 2; ++i) {
-            for (int j{}; j < 2; ++j) {
-                for (int k{}; k < 2; ++k) {
-                    auto x{ i*bbox.x.max + (1-i)*bbox.x.min };
-                    auto y{ j*bbox.y.max + (1-j)*bbox.y.min };
-                    auto z{ k*bbox.z.max + (1-k)*bbox.z.min };
-
-                    auto newx{  cos_theta*x + sin_theta*z };
-                    auto newz{ -sin_theta*x + cos_theta*z };
+    }
 
-                    vec3 tester{ newx, y, newz };
+    // Finds the closest t in ray_t and records in rec.object which entity completes the hit.
+    // Primitives only write t (and what they get for free), so candidates replaced by a closer
+    // hit during traversal never pay for normals, uv or the material lookup.
+    virtual bool intersect(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
-                    for (int c{}; c < 3; ++c) {
-                        min[c] = std::fmin(min[c], tester[c]);
-                        max[c] = std::fmax(max[c], tester[c]);
-                    }
-                }
-            }
-        }
+    // Fills p, normal, front_face, u, v and mat for a hit found by intersect, once per traced ray.
+    // Wrappers that transform a hit finish it inside intersect and keep this empty.
+    virtual void surface_interaction([[maybe_unused]] const ray& r, [[maybe_unused]] hit_record& rec) const {}
 
-        bbox = aabb(min, max);
+    // Visibility only: true as soon as any hit inside ray_t is found, no matter if it is the closest,
+    // and nothing is filled in. Aggregates override it to stop traversal early.
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        hit_record rec{};
+        return intersect(r, ray_t, rec);
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        // Transform the ray from world space to object space.
-        auto origin{ point3{(cos_theta * r.origin().x()) - (sin_theta * r.origin().z())
-            , r.origin().y()
-            , (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())} };
-
-        auto direction{ vec3{(cos_theta * r.direction().x()) - (sin_theta * r.direction().z())
-            , r.direction().y()
-            , (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())}};
-
-        ray rotate_r{ origin, direction, r.time() };
+    virtual aabb bounding_box() const = 0;
 
-        // Determine whether an intersection exists in object space (and if so, where).
-        
-        if (!object->hit(rotate_r, ray_t, rec))
-            return false;
+    // Appends the emissive primitives below this entity, object_to_world places this entity in the scene.
+    // Aggregates forward to their children, instances compose their transform, light_bvh is built from the result.
+    virtual void collect_emitters([[maybe_unused]] const affine3& object_to_world
+        , [[maybe_unused]] std::vector<emitter>& emitters) const {}
 
-        // Transform the intersection from object space back to world space.
+    // Bounds at one instant, motion BVHs sample it at shutter open and close. Static entities keep the full box.
+    virtual aabb bounding_box_at([[maybe_unused]] float time) const { return bounding_box(); }
 
-        rec.p = point3{
-            (cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
-            rec.p.y(),
-            (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z())
-        };
+    virtual float pdf_value([[maybe_unused]] const point3& origin, [[maybe_unused]] const vec3& direction) const { return 0.f; }
 
-        rec.normal = vec3{
-            (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
-            rec.normal.y(),
-            (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z())
-        };
+    // Density of direction for the first light it reaches only, P(light) * its pdf: what light_sample::emitter_pdf
+    // holds when that light produced the direction. A single emitter has nothing to choose from.
+    virtual float emitter_pdf_value(const point3& origin, const vec3& direction) const { return pdf_value(origin, direction); }
 
-        return true;
-    }
+    virtual vec3 random([[maybe_unused]] const point3& origin) const { return vec3(1, 0, 0); }
 
-    aabb bounding_box() const override { return bbox; }
+    // Direction, distance, pdf and radiance of one light sample together, false when origin cannot see any
+    // of the light (inside a sphere light, ...). The default traces random() against the entity to find the
+    // point, emitters with an analytic solid angle sample override it.
+    virtual bool sample_light(const point3& origin, light_sample& sample) const;
 };
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+// Shared by the emissive primitives: area, normal axis and cos(theta_o) are given in object space, a diffuse
+// emitter only lights its front hemisphere so theta_e is always 90 degrees
+inline emitter make_emitter(const entity& object, const affine3& object_to_world, float radiance, float area,
+                            const vec3& axis, float cos_theta_o) {
+    emitter light{};
+    light.object = &object;
+    light.object_to_world = object_to_world;
+    light.world_to_object = object_to_world.inverse();
+    light.transformed = !object_to_world.is_identity();
+    light.bounds = object_to_world.transform_box(object.bounding_box());
+    light.power = radiance * area * std::pow(std::fabs(object_to_world.determinant()), 2.f / 3.f);
+    light.axis = unit_vector(light.world_to_object.transform_normal(axis));
+    light.cos_theta_o = cos_theta_o;
+    light.cos_theta_e = 0.f;
+    return light;
+}
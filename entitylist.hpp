@@ -25,10 +25,23 @@ public:
         bbox = aabb(bbox, ent->bounding_box());
     }
 
-    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
+    virtual bool intersect(const ray& r, interval ray_t, hit_record& rec) const override;
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        for (const auto& ent : entities) {
+            if (ent->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
 
     aabb bounding_box() const override { return bbox; }
 
+    void collect_emitters(const affine3& object_to_world, std::vector<emitter>& emitters) const override {
+        for (const auto& ent : entities)
+            ent->collect_emitters(object_to_world, emitters);
+    }
+
     float pdf_value(const point3& origin, const vec3& direction) const override {
         float weight{ 1.f / entities.size() };
         float sum{ 0.f };
@@ -39,24 +52,51 @@ public:
         return sum;
     }
 
+    // Only the closest entity along direction, weighted by the uniform pick
+    float emitter_pdf_value(const point3& origin, const vec3& direction) const override {
+        const ray r{ origin, direction };
+        hit_record rec{};
+        const entity* first{ nullptr };
+        float closest{ infinity };
+        for (const auto& ent : entities) {
+            if (ent->intersect(r, interval(0.001f, closest), rec)) {
+                closest = rec.t;
+                first = ent.get();
+            }
+        }
+
+        return first ? first->emitter_pdf_value(origin, direction) / entities.size() : 0.f;
+    }
+
     vec3 random(const point3& origin) const override {
         int index{ random_int(0, static_cast<int>(entities.size() - 1)) };
         return entities[index]->random(origin);
     }
 
+    // One light picked uniformly, the density is pdf_value's: every light the direction reaches could have produced it
+    bool sample_light(const point3& origin, light_sample& sample) const override {
+        int index{ random_int(0, static_cast<int>(entities.size() - 1)) };
+        if (!entities[index]->sample_light(origin, sample))
+            return false;
+
+        sample.emitter_pdf /= static_cast<float>(entities.size());
+        sample.pdf = pdf_value(origin, sample.direction);
+        return sample.pdf > 0.f;
+    }
+
 };
 #pragma endregion
 
 #pragma region entity_list definition
 
 
-bool entity_list::hit(const ray& r, interval ray_t, hit_record& rec) const {
+bool entity_list::intersect(const ray& r, interval ray_t, hit_record& rec) const {
     hit_record tmp_rec;
     bool hit_anything{ false };
     float closest_so_far{ ray_t.max };
     for (const auto& ent : entities)
     {
-        if (ent->hit(r, interval(ray_t.min, closest_so_far), tmp_rec)) {
+        if (ent->intersect(r, interval(ray_t.min, closest_so_far), tmp_rec)) {
             hit_anything = true;
             closest_so_far = tmp_rec.t;
             rec = tmp_rec;
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "color.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+constexpr int tile_size{ 16 };
+constexpr std::size_t cache_line_size{ 64 };
+
+// Thread private accumulation storage for one tile, indexed [y * tile_size + x] in tile local coordinates
+using tile_accumulator = std::array<pixel_accumulator, tile_size * tile_size>;
+
+#pragma region published tile
+static_assert(std::is_trivially_copyable_v<tile_accumulator> && sizeof(tile_accumulator) % sizeof(uint32_t) == 0);
+constexpr std::size_t tile_words{ sizeof(tile_accumulator) / sizeof(uint32_t) };
+
+// Every tile starts on its own cache line and is padded to whole lines,
+// so a worker publishing its tile never touches a line owned by a neighbouring tile.
+struct alignas(cache_line_size) frame_tile {
+    // Sequence lock: odd while the owning worker is copying a new pass in.
+    // Only one worker ever writes a tile, readers (preview, output) retry on a torn read.
+    std::atomic<uint32_t> sequence{ 0 };
+    // The pixels as relaxed atomic words, a reader racing the writer gets a torn copy it throws away
+    // instead of a data race. Relaxed word copies compile to plain moves.
+    std::array<std::atomic<uint32_t>, tile_words> pixels{};
+};
+#pragma endregion
+
+#pragma region tile major frame buffer
+class frame_buffer {
+
+    int width{};
+    int height{};
+    int tiles_x{};
+    int tiles_y{};
+    std::vector<frame_tile> tiles;
+
+public:
+
+    frame_buffer(int width, int height)
+        : width{ width }, height{ height }
+        , tiles_x{ (width + tile_size - 1) / tile_size }
+        , tiles_y{ (height + tile_size - 1) / tile_size }
+        , tiles(static_cast<size_t>(tiles_x) * tiles_y)
+        {}
+
+    frame_buffer(const frame_buffer&) = delete;
+    frame_buffer& operator=(const frame_buffer&) = delete;
+
+    int tile_count() const { return tiles_x * tiles_y; }
+
+    int tile_x_begin(int tile_index) const { return (tile_index % tiles_x) * tile_size; }
+    int tile_y_begin(int tile_index) const { return (tile_index / tiles_x) * tile_size; }
+    int tile_x_end(int tile_index) const { return std::min(tile_x_begin(tile_index) + tile_size, width); }
+    int tile_y_end(int tile_index) const { return std::min(tile_y_begin(tile_index) + tile_size, height); }
+
+    // Called by the single worker that owns the tile at a pass boundary.
+    void publish(int tile_index, const tile_accumulator& local) {
+        frame_tile& tile{ tiles[tile_index] };
+        const uint32_t seq{ tile.sequence.load(std::memory_order_relaxed) };
+
+        tile.sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        const auto* bytes{ reinterpret_cast<const unsigned char*>(&local) };
+        for (std::size_t i{ 0 }; i < tile_words; ++i) {
+            uint32_t word;
+            std::memcpy(&word, bytes + i * sizeof(word), sizeof(word));
+            tile.pixels[i].store(word, std::memory_order_relaxed);
+        }
+        tile.sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    void read_tile(int tile_index, tile_accumulator& out) const {
+        const frame_tile& tile{ tiles[tile_index] };
+
+        while (true) {
+            const uint32_t seq_before{ tile.sequence.load(std::memory_order_acquire) };
+            if (seq_before & 1u) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            auto* bytes{ reinterpret_cast<unsigned char*>(&out) };
+            for (std::size_t i{ 0 }; i < tile_words; ++i) {
+                const uint32_t word{ tile.pixels[i].load(std::memory_order_relaxed) };
+                std::memcpy(bytes + i * sizeof(word), &word, sizeof(word));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (tile.sequence.load(std::memory_order_relaxed) == seq_before)
+                return;
+        }
+    }
+
+    // Row major copy of the published data for the preview window and image output.
+    void resolve(std::vector<pixel_accumulator>& out) const {
+        out.resize(static_cast<size_t>(width) * height);
+        tile_accumulator tile_copy;
+
+        for (int tile_index{}; tile_index < tile_count(); ++tile_index) {
+            read_tile(tile_index, tile_copy);
+
+            const int x_begin{ tile_x_begin(tile_index) };
+            const int y_begin{ tile_y_begin(tile_index) };
+            const int x_end{ tile_x_end(tile_index) };
+            const int y_end{ tile_y_end(tile_index) };
+
+            for (int y{ y_begin }; y < y_end; ++y)
+                for (int x{ x_begin }; x < x_end; ++x)
+                    out[y * width + x] = tile_copy[(y - y_begin) * tile_size + (x - x_begin)];
+        }
+    }
+
+    std::vector<pixel_accumulator> resolve() const {
+        std::vector<pixel_accumulator> out;
+        resolve(out);
+        return out;
+    }
+};
+#pragma endregion
@@ -8,6 +8,7 @@
 #include <chrono>
 
 #include "../color.hpp"
+#include "../frame_buffer.hpp"
 
 
 #ifdef _WIN32
@@ -23,21 +24,21 @@
     inline std::mutex g_buffer_mutex;
     inline std::atomic<bool> g_window_closed(false);
 
-    void update_preview(const std::vector<color>& pixels, const std::vector<int>& sample_counts, int width, int height) {
+    void update_preview(const std::vector<pixel_accumulator>& pixels, int width, int height) {
         // Create a local bitmap buffer
         std::vector<RGBQUAD> bitmap_buffer(width * height, RGBQUAD{77, 77, 77, 0});
         
         // Fill with pixel data
         for (int i = 0; i < width * height; i++) {
-            int count{ sample_counts[i] };
+            int count{ pixels[i].samples };
 
             if (count == 0) {
                 continue; // Skip further calculations
             }
             
-            float r = pixels[i].x() / count;
-            float g = pixels[i].y() / count;
-            float b = pixels[i].z() / count;
+            float r = pixels[i].sum.x() / count;
+            float g = pixels[i].sum.y() / count;
+            float b = pixels[i].sum.z() / count;
 
             r = sqrt(std::min(r, 1.0f));
             g = sqrt(std::min(g, 1.0f));
@@ -127,8 +128,7 @@
     }
 
     void window_thread_func(HINSTANCE h_instance, int width, int height
-        , const std::vector<color>& pixels, const std::vector<int>& sample_counts
-        , std::mutex& frame_buffer_mut, std::mutex& samples_mut
+        , const frame_buffer& frame
         , std::chrono::steady_clock::time_point& render_start_time
         , std::atomic<bool>& rendering_active, std::string& final_render_time) {
         WNDCLASS wc{0};
@@ -160,6 +160,7 @@
         UpdateWindow(g_hwnd);
 
         MSG msg;
+        std::vector<pixel_accumulator> pixels;
         while (!g_window_closed) {
             auto start_time = std::chrono::high_resolution_clock::now();
             while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
@@ -171,11 +172,9 @@
                 DispatchMessage(&msg);
             }
 
-            {
-                std::lock_guard<std::mutex> lock(frame_buffer_mut);
-                std::lock_guard<std::mutex> lock_samples(samples_mut);
-                update_preview(pixels, sample_counts, width, height);
-            }
+            // Reads only what the workers have published, no render locks involved
+            frame.resolve(pixels);
+            update_preview(pixels, width, height);
 
             std::string time_display{};
             if (rendering_active) {
@@ -0,0 +1,423 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "affine.hpp"
+#include "entity.hpp"
+#include "ray.hpp"
+#include "rtweekend.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#pragma region light bounds
+// What a light BVH node knows about the emitters below it: where they are, how much they emit in total
+// and a cone around axis holding their normals (theta_o), light leaves up to theta_e past a normal.
+struct light_bounds {
+    aabb bounds{ aabb::empty };
+    vec3 axis{ 0.f, 0.f, 1.f };
+    float power{};
+    float cos_theta_o{ 1.f };
+    float cos_theta_e{ 1.f };
+
+    light_bounds() {}
+
+    explicit light_bounds(const emitter& light)
+        : bounds{ light.bounds }
+        , axis{ light.axis }
+        , power{ light.power }
+        , cos_theta_o{ light.cos_theta_o }
+        , cos_theta_e{ light.cos_theta_e }
+    {}
+
+    light_bounds(const light_bounds& a, const light_bounds& b) {
+        if (a.power <= 0.f) { *this = b; return; }
+        if (b.power <= 0.f) { *this = a; return; }
+
+        bounds = aabb(a.bounds, b.bounds);
+        power = a.power + b.power;
+        cos_theta_e = std::fmin(a.cos_theta_e, b.cos_theta_e);
+        merge_cones(a, b);
+    }
+
+    // Upper bound of the light arriving at p from anything below this node, up to a common constant.
+    // theta' is the smallest angle between the direction to p and any normal the node can hold.
+    float importance(const point3& p) const {
+        const point3 center{ bounds.centroid() };
+        const vec3 half_diagonal{ 0.5f * vec3(bounds.x.size(), bounds.y.size(), bounds.z.size()) };
+        const float radius_squared{ half_diagonal.squared_length() };
+        const vec3 to_p{ p - center };
+        const float distance_squared{ to_p.squared_length() };
+
+        // Inside the bounding sphere every direction is possible, only the distance is clamped
+        if (distance_squared <= radius_squared)
+            return power / radius_squared;
+
+        const vec3 wi{ to_p / std::sqrt(distance_squared) };
+        const float cos_theta_w{ dot(axis, wi) };
+        const float sin_theta_w{ safe_sqrt(1.f - cos_theta_w * cos_theta_w) };
+
+        const float cos_theta_b{ safe_sqrt(1.f - radius_squared / distance_squared) };
+        const float sin_theta_b{ safe_sqrt(1.f - cos_theta_b * cos_theta_b) };
+        const float sin_theta_o{ safe_sqrt(1.f - cos_theta_o * cos_theta_o) };
+
+        // theta' = max(0, theta_w - theta_o - theta_b)
+        const float cos_theta_x{ cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o) };
+        const float sin_theta_x{ sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o) };
+        const float cos_theta_p{ cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b) };
+
+        if (cos_theta_p <= cos_theta_e)
+            return 0.f;
+
+        return power * cos_theta_p / distance_squared;
+    }
+
+    // Solid angle measure of the cone weighted by the emission falloff, the orientation term of the SAOH
+    float orientation_measure() const {
+        const float theta_o{ std::acos(std::clamp(cos_theta_o, -1.f, 1.f)) };
+        const float theta_e{ std::acos(std::clamp(cos_theta_e, -1.f, 1.f)) };
+        const float theta_w{ std::fmin(theta_o + theta_e, pi) };
+        const float sin_theta_o{ safe_sqrt(1.f - cos_theta_o * cos_theta_o) };
+        return 2.f * pi * (1.f - cos_theta_o)
+            + pi / 2.f * (2.f * theta_w * sin_theta_o - std::cos(theta_o - 2.f * theta_w) - 2.f * theta_o * sin_theta_o + cos_theta_o);
+    }
+
+private:
+
+    static float safe_sqrt(float x) { return std::sqrt(std::fmax(0.f, x)); }
+
+    // cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+    static float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+        if (cos_a > cos_b)
+            return 1.f;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    static float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+        if (cos_a > cos_b)
+            return 0.f;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    // Smallest cone holding both, the axis is turned from a towards b
+    void merge_cones(const light_bounds& a, const light_bounds& b) {
+        const float theta_a{ std::acos(std::clamp(a.cos_theta_o, -1.f, 1.f)) };
+        const float theta_b{ std::acos(std::clamp(b.cos_theta_o, -1.f, 1.f)) };
+        const float theta_d{ std::acos(std::clamp(dot(a.axis, b.axis), -1.f, 1.f)) };
+
+        if (std::fmin(theta_d + theta_b, pi) <= theta_a) {
+            axis = a.axis;
+            cos_theta_o = a.cos_theta_o;
+            return;
+        }
+        if (std::fmin(theta_d + theta_a, pi) <= theta_b) {
+            axis = b.axis;
+            cos_theta_o = b.cos_theta_o;
+            return;
+        }
+
+        const float theta_o{ 0.5f * (theta_a + theta_d + theta_b) };
+        const vec3 rotation_axis{ cross(a.axis, b.axis) };
+        if (theta_o >= pi || rotation_axis.squared_length() == 0.f) {
+            axis = a.axis;
+            cos_theta_o = -1.f;
+            return;
+        }
+
+        const float theta_r{ theta_o - theta_a };
+        axis = unit_vector(affine3::rotation(rotation_axis, theta_r * 180.f / pi).transform_vector(a.axis));
+        cos_theta_o = std::cos(theta_o);
+    }
+};
+#pragma endregion
+
+#pragma region light BVH node
+// Interior: the first child follows the node, offset is the second child. Leaf: one emitter, offset indexes it.
+struct light_bvh_node {
+    light_bounds bounds;
+    uint32_t offset{};
+    bool leaf{};
+};
+#pragma endregion
+
+#pragma region light BVH decl
+// Importance sampled light selection over every emitter of a scene (Conty & Kulla): each step down the tree picks
+// a child in proportion to the power it can deliver to the shading point, so picking a light and evaluating the
+// probability of one both cost O(depth) instead of a loop over all lights.
+// Acts as the lights entity of camera::render, intersect is never used.
+class light_bvh : public entity {
+
+    std::vector<emitter> emitters;
+    std::vector<light_bvh_node> nodes;
+
+    static constexpr int bucket_count{ 12 };
+    static constexpr int max_traversal_depth{ 64 };
+    static constexpr int max_heuristic_depth{ 32 }; // deeper splits halve by count, keeps the tree under 64 levels
+
+    struct pdf_entry {
+        uint32_t node;
+        float pmf;
+    };
+
+    // Surface area orientation heuristic of one side of a split, Kr keeps thin boxes from being cut lengthwise
+    static float split_cost(const light_bounds& side, const aabb& node_bounds, int axis) {
+        const float extent[3]{ node_bounds.x.size(), node_bounds.y.size(), node_bounds.z.size() };
+        const float longest{ std::fmax(extent[0], std::fmax(extent[1], extent[2])) };
+        const float aspect{ extent[axis] > 0.f ? longest / extent[axis] : 1.f };
+        return side.power * side.orientation_measure() * aspect * side.bounds.surface_area();
+    }
+
+    uint32_t build(std::vector<uint32_t>& order, size_t begin, size_t end, int depth) {
+        const auto node_index{ static_cast<uint32_t>(nodes.size()) };
+        nodes.emplace_back();
+
+        light_bounds total{};
+        aabb centroid_bounds{ aabb::empty };
+        for (size_t i{ begin }; i < end; ++i) {
+            total = light_bounds(total, light_bounds(emitters[order[i]]));
+            const point3 c{ emitters[order[i]].bounds.centroid() };
+            centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+        }
+        nodes[node_index].bounds = total;
+
+        if (end - begin == 1) {
+            nodes[node_index].leaf = true;
+            nodes[node_index].offset = order[begin];
+            return node_index;
+        }
+
+        // Binned SAOH over all three axes
+        float best_cost{ infinity };
+        int best_axis{ -1 };
+        int best_split{ 0 };
+        for (int axis{ 0 }; axis < 3 && depth < max_heuristic_depth; ++axis) {
+            const interval& span{ centroid_bounds.axis_interval(axis) };
+            if (span.size() <= 0.f)
+                continue;
+
+            std::array<light_bounds, bucket_count> buckets{};
+            for (size_t i{ begin }; i < end; ++i) {
+                const float c{ emitters[order[i]].bounds.centroid()[axis] };
+                const int b{ std::min(bucket_count - 1, static_cast<int>(bucket_count * (c - span.min) / span.size())) };
+                buckets[b] = light_bounds(buckets[b], light_bounds(emitters[order[i]]));
+            }
+
+            for (int split{ 0 }; split < bucket_count - 1; ++split) {
+                light_bounds below{}, above{};
+                for (int b{ 0 }; b <= split; ++b) below = light_bounds(below, buckets[b]);
+                for (int b{ split + 1 }; b < bucket_count; ++b) above = light_bounds(above, buckets[b]);
+
+                const float cost{ split_cost(below, total.bounds, axis) + split_cost(above, total.bounds, axis) };
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+
+        size_t middle{ (begin + end) / 2 };
+        if (best_axis >= 0) {
+            const interval& span{ centroid_bounds.axis_interval(best_axis) };
+            const auto first_above{ std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t index) {
+                const float c{ emitters[index].bounds.centroid()[best_axis] };
+                const int b{ std::min(bucket_count - 1, static_cast<int>(bucket_count * (c - span.min) / span.size())) };
+                return b <= best_split;
+            }) };
+            middle = static_cast<size_t>(first_above - order.begin());
+        }
+
+        // Coincident centroids or an empty side, halve by count
+        if (middle == begin || middle == end)
+            middle = (begin + end) / 2;
+
+        build(order, begin, middle, depth + 1);
+        const uint32_t second{ build(order, middle, end, depth + 1) };
+        nodes[node_index].offset = second;
+        return node_index;
+    }
+
+    // Emitters answer per unit solid angle of their own space, a scaled or sheared placement changes it
+    static float emitter_density(const emitter& light, float object_pdf, const vec3& world_direction) {
+        if (!light.transformed || object_pdf <= 0.f)
+            return object_pdf;
+        return object_pdf * light.world_to_object.solid_angle_jacobian(world_direction);
+    }
+
+    // Probability of stepping into the first child, even when neither child can reach p so that sampling never
+    // fails: the choice is then arbitrary but pdf_value follows the same rule
+    float first_child_probability(uint32_t node_index, const point3& p) const {
+        const float first{ nodes[node_index + 1].bounds.importance(p) };
+        const float second{ nodes[nodes[node_index].offset].bounds.importance(p) };
+        return first + second > 0.f ? first / (first + second) : 0.5f;
+    }
+
+public:
+
+    // Walks the scene graph once, the emitters keep pointing into world so it has to outlive the light_bvh
+    explicit light_bvh(const entity& world, bool print_stats = false) {
+        world.collect_emitters(affine3::identity(), emitters);
+        if (emitters.empty())
+            return;
+
+        std::vector<uint32_t> order(emitters.size());
+        for (uint32_t i{ 0 }; i < order.size(); ++i)
+            order[i] = i;
+
+        nodes.reserve(2 * emitters.size() - 1);
+        build(order, 0, emitters.size(), 0);
+
+        if (print_stats)
+            std::clog << "Light BVH built: " << emitters.size() << " emitters, " << nodes.size() << " nodes\n";
+    }
+
+    bool empty() const { return emitters.empty(); }
+
+    size_t emitter_count() const { return emitters.size(); }
+
+    bool intersect(const ray&, interval, hit_record&) const override { return false; }
+
+    aabb bounding_box() const override { return nodes.empty() ? aabb::empty : nodes[0].bounds.bounds; }
+
+    // Sum over the emitters the direction reaches of P(emitter) * pdf(direction | emitter). Only subtrees whose
+    // bounds the direction passes through can contribute, their probabilities are rebuilt on the way down.
+    float pdf_value(const point3& origin, const vec3& direction) const override {
+        if (nodes.empty())
+            return 0.f;
+
+        const traversal_ray tr{ ray(origin, direction) };
+        const interval ray_t{ 0.001f, infinity };
+
+        pdf_entry to_visit[max_traversal_depth];
+        int to_visit_count{ 0 };
+        to_visit[to_visit_count++] = pdf_entry{ 0, 1.f };
+
+        float pdf{ 0.f };
+        while (to_visit_count > 0) {
+            const pdf_entry entry{ to_visit[--to_visit_count] };
+            const light_bvh_node& node{ nodes[entry.node] };
+
+            if (!node.bounds.bounds.hit(tr, ray_t))
+                continue;
+
+            if (node.leaf) {
+                const emitter& light{ emitters[node.offset] };
+                pdf += entry.pmf * emitter_density(light, light.object->pdf_value(
+                    light.transformed ? light.world_to_object.transform_point(origin) : origin,
+                    light.transformed ? light.world_to_object.transform_vector(direction) : direction), direction);
+                continue;
+            }
+
+            const float p_first{ first_child_probability(entry.node, origin) };
+            if (p_first > 0.f)
+                to_visit[to_visit_count++] = pdf_entry{ entry.node + 1, entry.pmf * p_first };
+            if (p_first < 1.f)
+                to_visit[to_visit_count++] = pdf_entry{ node.offset, entry.pmf * (1.f - p_first) };
+        }
+
+        return pdf;
+    }
+
+    // P(emitter) * pdf(direction | emitter) for the closest emitter the direction hits, found with the same
+    // traversal as pdf_value but intersecting the emitters in the leaves
+    float emitter_pdf_value(const point3& origin, const vec3& direction) const override {
+        if (nodes.empty())
+            return 0.f;
+
+        const traversal_ray tr{ ray(origin, direction) };
+        const interval ray_t{ 0.001f, infinity };
+
+        pdf_entry to_visit[max_traversal_depth];
+        int to_visit_count{ 0 };
+        to_visit[to_visit_count++] = pdf_entry{ 0, 1.f };
+
+        float closest{ infinity };
+        float pdf{ 0.f };
+        while (to_visit_count > 0) {
+            const pdf_entry entry{ to_visit[--to_visit_count] };
+            const light_bvh_node& node{ nodes[entry.node] };
+
+            if (!node.bounds.bounds.hit(tr, interval(ray_t.min, closest)))
+                continue;
+
+            if (node.leaf) {
+                const emitter& light{ emitters[node.offset] };
+                const ray r{ light.transformed
+                    ? ray(light.world_to_object.transform_point(origin), light.world_to_object.transform_vector(direction))
+                    : ray(origin, direction) };
+
+                hit_record rec{};
+                if (light.object->intersect(r, interval(ray_t.min, closest), rec)) {
+                    closest = rec.t;
+                    pdf = entry.pmf * emitter_density(light, light.object->emitter_pdf_value(r.origin(), r.direction()), direction);
+                }
+                continue;
+            }
+
+            const float p_first{ first_child_probability(entry.node, origin) };
+            if (p_first > 0.f)
+                to_visit[to_visit_count++] = pdf_entry{ entry.node + 1, entry.pmf * p_first };
+            if (p_first < 1.f)
+                to_visit[to_visit_count++] = pdf_entry{ node.offset, entry.pmf * (1.f - p_first) };
+        }
+
+        return pdf;
+    }
+
+    vec3 random(const point3& origin) const override {
+        if (nodes.empty())
+            return vec3(1.f, 0.f, 0.f);
+
+        uint32_t index{ 0 };
+        while (!nodes[index].leaf)
+            index = random_float() < first_child_probability(index, origin) ? index + 1 : nodes[index].offset;
+
+        const emitter& light{ emitters[nodes[index].offset] };
+        if (!light.transformed)
+            return light.object->random(origin);
+
+        return light.object_to_world.transform_vector(light.object->random(light.world_to_object.transform_point(origin)));
+    }
+
+    // Same descent as random. Lights overlapping in solid angle can all produce the direction, so its density is
+    // pdf_value's sum; the probability of the path taken scales the chosen light's own pdf into emitter_pdf.
+    bool sample_light(const point3& origin, light_sample& sample) const override {
+        if (nodes.empty())
+            return false;
+
+        uint32_t index{ 0 };
+        float pmf{ 1.f };
+        while (!nodes[index].leaf) {
+            const float p_first{ first_child_probability(index, origin) };
+            if (random_float() < p_first) {
+                pmf *= p_first;
+                index = index + 1;
+            } else {
+                pmf *= 1.f - p_first;
+                index = nodes[index].offset;
+            }
+        }
+
+        const emitter& light{ emitters[nodes[index].offset] };
+        if (!light.transformed) {
+            if (!light.object->sample_light(origin, sample))
+                return false;
+        } else {
+            if (!light.object->sample_light(light.world_to_object.transform_point(origin), sample))
+                return false;
+
+            sample.direction = light.object_to_world.transform_vector(sample.direction);
+            sample.distance = sample.direction.length();
+            sample.emitter_pdf = emitter_density(light, sample.emitter_pdf, sample.direction);
+        }
+
+        sample.emitter_pdf *= pmf;
+        sample.pdf = pdf_value(origin, sample.direction);
+        return sample.pdf > 0.f;
+    }
+};
+#pragma endregion
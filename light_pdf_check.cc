@@ -0,0 +1,110 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// iclude order matters, same as scenes.hpp
+#include "camera.hpp"
+#include "entitylist.hpp"
+#include "light_bvh.hpp"
+#include "material.hpp"
+#include "quad.hpp"
+#include "sphere.hpp"
+#include "transform.hpp"
+
+// sample_light and pdf_value have to agree on the density of a direction, callers mix the two.
+// Two stacked lights seen from below overlap in solid angle, the case where a single light's pdf falls short.
+auto check(const entity& lights, const char* name) -> int
+{
+    constexpr int N{ 100'000 };
+    int mismatches{ 0 };
+
+    for (int i{ 0 }; i < N; ++i)
+    {
+        const point3 origin{ random_float(-2.f, 3.f), random_float(-1.f, 0.5f), random_float(-2.f, 3.f) };
+        light_sample sample{};
+        if (!lights.sample_light(origin, sample))
+            continue;
+
+        const float pdf{ lights.pdf_value(origin, sample.direction) };
+        if (std::fabs(sample.pdf - pdf) > 1e-4f * pdf)
+            ++mismatches;
+    }
+
+    std::cout << name << ": " << mismatches << " of " << N << " samples disagree with pdf_value\n";
+    return mismatches;
+}
+
+// A density integrates to one over the directions it covers, so the mean of 1 / pdf over its own samples is the
+// solid angle the light covers from origin. For a scaled instance that has to be the world space solid angle,
+// counted here by shooting uniform directions at the light. Object space densities miss it by the Jacobian.
+auto check_solid_angle(const entity& light, const entity& lights, const point3& origin, const char* name) -> int
+{
+    constexpr int N{ 1'000'000 };
+
+    double inverse_pdf_sum{ 0. };
+    for (int i{ 0 }; i < N; ++i)
+    {
+        light_sample sample{};
+        if (lights.sample_light(origin, sample))
+            inverse_pdf_sum += 1. / sample.pdf;
+    }
+
+    int hits{ 0 };
+    for (int i{ 0 }; i < N; ++i)
+    {
+        hit_record rec{};
+        if (light.hit(ray(origin, random_unit_vector()), interval(0.001f, infinity), rec))
+            ++hits;
+    }
+
+    const double sampled{ inverse_pdf_sum / N };
+    const double counted{ 4. * pi * hits / N };
+    const bool failed{ std::fabs(sampled - counted) > 0.02 * counted };
+
+    std::cout << name << ": solid angle " << sampled << " from the pdf, " << counted << " counted"
+        << (failed ? " MISMATCH" : "") << "\n";
+    return failed ? 1 : 0;
+}
+
+auto main() -> int
+{
+    auto light{ std::make_shared<diffuse_light>(color(4.f, 4.f, 4.f)) };
+
+    entity_list lights;
+    lights.add(std::make_shared<quad>(point3(0.f, 1.f, 0.f), vec3(0.f, 0.f, 1.f), vec3(1.f, 0.f, 0.f), light));
+    lights.add(std::make_shared<quad>(point3(-0.5f, 2.f, -0.5f), vec3(0.f, 0.f, 2.f), vec3(2.f, 0.f, 0.f), light));
+
+    const light_bvh tree{ lights };
+
+    int failures{ check(lights, "entity_list") + check(tree, "light_bvh") };
+
+    // Non uniformly scaled and sheared placements, through the instance itself and as a transformed light_bvh leaf
+    const affine3 stretch{ affine3::translation(vec3(0.f, 2.f, 0.f)) * affine3::rotation(vec3(1.f, 0.f, 1.f), 30.f)
+        * affine3::scaling(vec3(3.f, 0.5f, 1.5f)) };
+    affine3 shear{ stretch };
+    shear.m[0][1] += 0.8f;
+
+    const point3 origin{ 0.3f, -0.5f, 0.2f };
+    const std::pair<const char*, std::shared_ptr<entity>> placed[]{
+        { "scaled quad", std::make_shared<instance>(
+            std::make_shared<quad>(point3(-0.5f, 0.f, -0.5f), vec3(0.f, 0.f, 1.f), vec3(1.f, 0.f, 0.f), light), stretch) },
+        { "sheared quad", std::make_shared<instance>(
+            std::make_shared<quad>(point3(-0.5f, 0.f, -0.5f), vec3(0.f, 0.f, 1.f), vec3(1.f, 0.f, 0.f), light), shear) },
+        { "scaled sphere", std::make_shared<instance>(std::make_shared<sphere>(point3(0.f, 0.f, 0.f), 0.5f, light), stretch) },
+        { "sheared sphere", std::make_shared<instance>(std::make_shared<sphere>(point3(0.f, 0.f, 0.f), 0.5f, light), shear) },
+    };
+
+    for (const auto& [name, light_instance] : placed)
+    {
+        entity_list single{ light_instance };
+        const light_bvh single_tree{ single };
+        failures += check(single, name) + check(single_tree, name);
+        failures += check_solid_angle(*light_instance, *light_instance, origin, name);
+        failures += check_solid_angle(*light_instance, single_tree, origin, name);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
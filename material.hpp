@@ -10,9 +10,13 @@
 #pragma region SCATER RECORD
 struct scatter_record {
     color attenuation{};
-    std::shared_ptr<pdf> pdf_ptr;
+    material_pdf pdf_storage{}; // by value, scattering never touches the heap
     bool skip_pdf{};
     ray skip_pdf_ray{};
+
+    const pdf& scatter_pdf() const {
+        return std::visit([](const auto& p) -> const pdf& { return p; }, pdf_storage);
+    }
 };
 #pragma endregion
 #pragma region ABSTRACT material declaration
@@ -27,10 +31,32 @@ public:
     virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const { return false; }
 
     virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const { return 0.f; }
+
+    // Typical front face radiance, only ranks lights for sampling. Black means the material never emits.
+    virtual color average_emission() const { return color{ 0.f, 0.f, 0.f }; }
 };
 
 #pragma endregion
 
+#pragma region default light sample
+// Lives here because reading the emission needs the material. One closest hit finds the sampled point.
+inline bool entity::sample_light(const point3& origin, light_sample& sample) const {
+    const ray to_light{ origin, random(origin) };
+    const float pdf{ pdf_value(origin, to_light.direction()) };
+
+    hit_record rec{};
+    if (pdf <= 0.f || !hit(to_light, interval(0.001f, infinity), rec))
+        return false;
+
+    sample.direction = rec.t * to_light.direction();
+    sample.distance = sample.direction.length();
+    sample.pdf = pdf;
+    sample.emitter_pdf = pdf;
+    sample.emitted = rec.mat->emitted(to_light, rec, rec.u, rec.v, rec.p);
+    return true;
+}
+#pragma endregion
+
 #pragma region LAMBERTIAN declaration
 
 class lambertian : public material {
@@ -54,7 +80,7 @@ public:
 bool lambertian::scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const
 {
     srec.attenuation = albedo_texture->value(rec.u, rec.v, rec.p);
-    srec.pdf_ptr = std::make_shared<cosine_pdf>(rec.normal);
+    srec.pdf_storage.emplace<cosine_pdf>(rec.normal);
     srec.skip_pdf = false;
     return true;
 }
@@ -87,7 +113,6 @@ bool metalic::scatter(const ray &r_in, const hit_record &rec, scatter_record& sr
 {
     auto reflected{ unit_vector(reflect(r_in.direction(), rec.normal)) + fuzz * random_in_unit_sphere() };
     srec.attenuation = albedo;
-    srec.pdf_ptr = nullptr;
     srec.skip_pdf = true;
     srec.skip_pdf_ray = ray(rec.p, reflected, r_in.time());
 
@@ -118,7 +143,6 @@ private:
 bool dielectric::scatter(const ray &r_in, const hit_record &rec, scatter_record& srec) const
 {
     srec.attenuation = color(1.0, 1.0, 1.0);
-    srec.pdf_ptr = nullptr;
     srec.skip_pdf = true;
     float refraction_ratio{ rec.front_face ? ( 1.0f / refraction_index ) : refraction_index };
     
@@ -154,6 +178,9 @@ public:
         return tex->value(u, v, p);
     }
 
+    // Middle of the texture, exact for the solid colors every scene uses
+    color average_emission() const override { return tex->value(0.5f, 0.5f, point3(0.f, 0.f, 0.f)); }
+
 };
 #pragma endregion
 
@@ -171,7 +198,7 @@ public:
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = std::make_shared<sphere_pdf>();
+        srec.pdf_storage.emplace<sphere_pdf>();
         srec.skip_pdf = false;
         return true;
     }
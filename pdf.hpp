@@ -3,7 +3,8 @@
 #include "entitylist.hpp"
 #include "onb.hpp"
 #include "vec3.hpp"
-#include <memory>
+#include <array>
+#include <variant>
 
 #pragma region PDF ABSTRACT class declaration
 class pdf
@@ -64,15 +65,13 @@ public:
 #pragma endregion
 
 #pragma region MIXTURE PDF declaration
+// Non owning, both pdfs live on the caller's stack for the duration of one bounce
 class mixture_pdf : public pdf
 {
-    std::array<std::shared_ptr<pdf>, 2> pdfs;
+    std::array<const pdf*, 2> pdfs;
 public:
 
-    mixture_pdf(std::shared_ptr<pdf> p0, std::shared_ptr<pdf> p1) {
-        pdfs[0] = p0;
-        pdfs[1] = p1;
-    }
+    mixture_pdf(const pdf& p0, const pdf& p1) : pdfs{ &p0, &p1 } {}
 
     float value(const vec3& direction) const override {
         return 0.5f * pdfs[0]->value(direction) + 0.5f * pdfs[1]->value(direction);
@@ -85,4 +84,14 @@ public:
             return pdfs[1]->generate();
     }
 };
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+// Power heuristic (beta = 2) weight of a sample drawn with pdf_a when pdf_b could have produced it as well
+__forceinline float power_heuristic(float pdf_a, float pdf_b) {
+    const float a{ pdf_a * pdf_a };
+    const float b{ pdf_b * pdf_b };
+    return a / (a + b);
+}
+
+// Storage for the pdfs materials hand back from scatter, held by value inside scatter_record
+using material_pdf = std::variant<sphere_pdf, cosine_pdf>;
\ No newline at end of file
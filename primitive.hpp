@@ -0,0 +1,89 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "box.hpp"
+#include "constant_medium.hpp"
+#include "entity.hpp"
+#include "quad.hpp"
+#include "sphere.hpp"
+#include "transform.hpp"
+
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <variant>
+
+#pragma region primitive storage
+// Built in primitives stored by value so BVH leaves are contiguous and dispatch with one switch on the tag
+// instead of a pointer chase plus a virtual call. Moving spheres are plain spheres with a non zero motion.
+// Anything else, including user classes derived from the built ins, keeps going through the entity interface.
+using primitive = std::variant<sphere, quad, axis_aligned_box, instance, constant_medium, std::shared_ptr<entity>>;
+
+// Exact type match on purpose: a subclass overriding is_interior or hit must keep its virtual behaviour
+inline primitive make_primitive(std::shared_ptr<entity> ent) {
+    const entity& object{ *ent };
+
+    if (typeid(object) == typeid(sphere))
+        return primitive{ std::in_place_type<sphere>, static_cast<const sphere&>(object) };
+    if (typeid(object) == typeid(quad))
+        return primitive{ std::in_place_type<quad>, static_cast<const quad&>(object) };
+    if (typeid(object) == typeid(axis_aligned_box))
+        return primitive{ std::in_place_type<axis_aligned_box>, static_cast<const axis_aligned_box&>(object) };
+    if (is_plain_instance(object))
+        return primitive{ std::in_place_type<instance>, static_cast<const instance&>(object) };
+    if (typeid(object) == typeid(constant_medium))
+        return primitive{ std::in_place_type<constant_medium>, static_cast<const constant_medium&>(object) };
+
+    return primitive{ std::in_place_type<std::shared_ptr<entity>>, std::move(ent) };
+}
+
+// Build time only, virtual dispatch is fine here
+inline void collect_primitive_emitters(const primitive& prim, const affine3& object_to_world, std::vector<emitter>& emitters) {
+    std::visit([&](const auto& object) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(object)>, std::shared_ptr<entity>>)
+            object->collect_emitters(object_to_world, emitters);
+        else
+            object.collect_emitters(object_to_world, emitters);
+    }, prim);
+}
+
+inline aabb primitive_bounds_at(const primitive& prim, float time) {
+    return std::visit([&](const auto& object) -> aabb {
+        if constexpr (std::is_same_v<std::decay_t<decltype(object)>, std::shared_ptr<entity>>)
+            return object->bounding_box_at(time);
+        else
+            return object.bounding_box_at(time);
+    }, prim);
+}
+
+// Qualified calls bind statically, the only virtual call left on a hit is surface_interaction on the closest one
+__forceinline bool intersect_primitive(const primitive& prim, const ray& r, interval ray_t, hit_record& rec) {
+    return std::visit([&](const auto& object) -> bool {
+        using object_type = std::decay_t<decltype(object)>;
+
+        if constexpr (std::is_same_v<object_type, std::shared_ptr<entity>>)
+            return object->intersect(r, ray_t, rec);
+        else if constexpr (std::is_same_v<object_type, quad>)
+            return object.intersect_parallelogram(r, ray_t, rec);
+        else
+            return object.object_type::intersect(r, ray_t, rec);
+    }, prim);
+}
+
+// Same static dispatch for visibility, aggregates and instances keep their early out
+__forceinline bool occluded_primitive(const primitive& prim, const ray& r, interval ray_t) {
+    return std::visit([&](const auto& object) -> bool {
+        using object_type = std::decay_t<decltype(object)>;
+        hit_record rec{};
+
+        if constexpr (std::is_same_v<object_type, std::shared_ptr<entity>>)
+            return object->occluded(r, ray_t);
+        else if constexpr (std::is_same_v<object_type, instance>)
+            return object.instance::occluded(r, ray_t);
+        else if constexpr (std::is_same_v<object_type, quad>)
+            return object.intersect_parallelogram(r, ray_t, rec);
+        else
+            return object.object_type::intersect(r, ray_t, rec);
+    }, prim);
+}
+#pragma endregion
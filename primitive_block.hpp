@@ -0,0 +1,188 @@
+#pragma once
+
+#include "interval.hpp"
+#include "quad.hpp"
+#include "ray.hpp"
+#include "sphere.hpp"
+
+#include <cstdint>
+#include <immintrin.h>
+
+#pragma region SIMD ray
+// Ray broadcast to all four lanes, shared by the block kernels of one leaf.
+struct simd_ray {
+    __m128 origin_x, origin_y, origin_z;
+    __m128 dir_x, dir_y, dir_z;
+    __m128 dir_length_squared;
+    __m128 time;
+
+    simd_ray() {}
+
+    explicit simd_ray(const ray& r)
+        : origin_x{ _mm_set1_ps(r.origin().x()) }
+        , origin_y{ _mm_set1_ps(r.origin().y()) }
+        , origin_z{ _mm_set1_ps(r.origin().z()) }
+        , dir_x{ _mm_set1_ps(r.direction().x()) }
+        , dir_y{ _mm_set1_ps(r.direction().y()) }
+        , dir_z{ _mm_set1_ps(r.direction().z()) }
+        , dir_length_squared{ _mm_set1_ps(r.direction().squared_length()) }
+        , time{ _mm_set1_ps(static_cast<float>(r.time())) }
+        {}
+};
+
+// Nearest of the lanes set in mask, ties go to the lower lane like the scalar leaf loop
+__forceinline int nearest_lane(int mask, __m128 t_lanes, float& t) {
+    alignas(16) float t_values[4];
+    _mm_store_ps(t_values, t_lanes);
+
+    int nearest{ -1 };
+    for (int lane{ 0 }; lane < 4; ++lane) {
+        if ((mask & (1 << lane)) && (nearest < 0 || t_values[lane] < t_values[nearest]))
+            nearest = lane;
+    }
+
+    t = t_values[nearest];
+    return nearest;
+}
+
+// Lane wise a if mask else b, plain SSE so no SSE4.1 blend is required
+__forceinline __m128 select_ps(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#pragma endregion
+
+#pragma region sphere block
+// Up to four spheres of one BVH leaf in SoA layout, same arithmetic as sphere::intersect lane by lane.
+struct alignas(16) sphere_block {
+    float center_x[4]{}, center_y[4]{}, center_z[4]{};
+    float motion_x[4]{}, motion_y[4]{}, motion_z[4]{};
+    float radius_squared[4]{};
+    uint32_t primitive[4]{};  // index into the owning tree's primitive array
+    uint32_t count{};
+
+    void add(const sphere& s, uint32_t primitive_index) {
+        const uint32_t lane{ count++ };
+        center_x[lane] = s.center.origin().x();
+        center_y[lane] = s.center.origin().y();
+        center_z[lane] = s.center.origin().z();
+        motion_x[lane] = s.center.direction().x();
+        motion_y[lane] = s.center.direction().y();
+        motion_z[lane] = s.center.direction().z();
+        radius_squared[lane] = s.radius * s.radius;
+        primitive[lane] = primitive_index;
+    }
+
+    // Lane of the nearest root strictly inside ray_t, or -1
+    int intersect(const simd_ray& r, const interval& ray_t, float& t) const {
+        const __m128 current_x{ _mm_add_ps(_mm_load_ps(center_x), _mm_mul_ps(r.time, _mm_load_ps(motion_x))) };
+        const __m128 current_y{ _mm_add_ps(_mm_load_ps(center_y), _mm_mul_ps(r.time, _mm_load_ps(motion_y))) };
+        const __m128 current_z{ _mm_add_ps(_mm_load_ps(center_z), _mm_mul_ps(r.time, _mm_load_ps(motion_z))) };
+
+        const __m128 oc_x{ _mm_sub_ps(r.origin_x, current_x) };
+        const __m128 oc_y{ _mm_sub_ps(r.origin_y, current_y) };
+        const __m128 oc_z{ _mm_sub_ps(r.origin_z, current_z) };
+
+        const __m128 half_b{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(oc_x, r.dir_x), _mm_mul_ps(oc_y, r.dir_y)), _mm_mul_ps(oc_z, r.dir_z)) };
+        const __m128 oc_length_squared{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(oc_x, oc_x), _mm_mul_ps(oc_y, oc_y)), _mm_mul_ps(oc_z, oc_z)) };
+        const __m128 c{ _mm_sub_ps(oc_length_squared, _mm_load_ps(radius_squared)) };
+        const __m128 discriminant{ _mm_sub_ps(_mm_mul_ps(half_b, half_b), _mm_mul_ps(r.dir_length_squared, c)) };
+
+        // A negative discriminant turns both roots into NaN, which fails every comparison below
+        const __m128 sqrtd{ _mm_sqrt_ps(discriminant) };
+        const __m128 neg_half_b{ _mm_sub_ps(_mm_setzero_ps(), half_b) };
+        const __m128 near_root{ _mm_div_ps(_mm_sub_ps(neg_half_b, sqrtd), r.dir_length_squared) };
+        const __m128 far_root{ _mm_div_ps(_mm_add_ps(neg_half_b, sqrtd), r.dir_length_squared) };
+
+        const __m128 t_min{ _mm_set1_ps(ray_t.min) };
+        const __m128 t_max{ _mm_set1_ps(ray_t.max) };
+        const __m128 near_inside{ _mm_and_ps(_mm_cmpgt_ps(near_root, t_min), _mm_cmplt_ps(near_root, t_max)) };
+        const __m128 far_inside{ _mm_and_ps(_mm_cmpgt_ps(far_root, t_min), _mm_cmplt_ps(far_root, t_max)) };
+
+        const int mask{ _mm_movemask_ps(_mm_or_ps(near_inside, far_inside)) & ((1 << count) - 1) };
+        if (mask == 0)
+            return -1;
+
+        return nearest_lane(mask, select_ps(near_inside, near_root, far_root), t);
+    }
+};
+#pragma endregion
+
+#pragma region quad block
+// Up to four parallelograms of one BVH leaf in SoA layout, same arithmetic as quad::intersect_parallelogram.
+struct alignas(16) quad_block {
+    float normal_x[4]{}, normal_y[4]{}, normal_z[4]{};
+    float plane_d[4]{};
+    float q_x[4]{}, q_y[4]{}, q_z[4]{};
+    float u_x[4]{}, u_y[4]{}, u_z[4]{};
+    float v_x[4]{}, v_y[4]{}, v_z[4]{};
+    float w_x[4]{}, w_y[4]{}, w_z[4]{};
+    uint32_t primitive[4]{};  // index into the owning tree's primitive array
+    uint32_t count{};
+
+    void add(const quad& q, uint32_t primitive_index) {
+        const uint32_t lane{ count++ };
+        normal_x[lane] = q.normal.x(); normal_y[lane] = q.normal.y(); normal_z[lane] = q.normal.z();
+        plane_d[lane] = q.D;
+        q_x[lane] = q.Q.x(); q_y[lane] = q.Q.y(); q_z[lane] = q.Q.z();
+        u_x[lane] = q.u.x(); u_y[lane] = q.u.y(); u_z[lane] = q.u.z();
+        v_x[lane] = q.v.x(); v_y[lane] = q.v.y(); v_z[lane] = q.v.z();
+        w_x[lane] = q.w.x(); w_y[lane] = q.w.y(); w_z[lane] = q.w.z();
+        primitive[lane] = primitive_index;
+    }
+
+    // Lane of the nearest hit with t inside ray_t (inclusive like quad), or -1. alpha/beta are its plane coordinates.
+    int intersect(const simd_ray& r, const interval& ray_t, float& t, float& alpha, float& beta) const {
+        const __m128 n_x{ _mm_load_ps(normal_x) };
+        const __m128 n_y{ _mm_load_ps(normal_y) };
+        const __m128 n_z{ _mm_load_ps(normal_z) };
+
+        const __m128 denom{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(n_x, r.dir_x), _mm_mul_ps(n_y, r.dir_y)), _mm_mul_ps(n_z, r.dir_z)) };
+        const __m128 abs_denom{ _mm_andnot_ps(_mm_set1_ps(-0.f), denom) };
+        const __m128 not_parallel{ _mm_cmpge_ps(abs_denom, _mm_set1_ps(1e-8f)) };
+
+        const __m128 n_dot_origin{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(n_x, r.origin_x), _mm_mul_ps(n_y, r.origin_y)), _mm_mul_ps(n_z, r.origin_z)) };
+        const __m128 t_lanes{ _mm_div_ps(_mm_sub_ps(_mm_load_ps(plane_d), n_dot_origin), denom) };
+        const __m128 t_inside{ _mm_and_ps(_mm_cmpge_ps(t_lanes, _mm_set1_ps(ray_t.min)), _mm_cmple_ps(t_lanes, _mm_set1_ps(ray_t.max))) };
+
+        // Hit point relative to Q
+        const __m128 h_x{ _mm_sub_ps(_mm_add_ps(r.origin_x, _mm_mul_ps(t_lanes, r.dir_x)), _mm_load_ps(q_x)) };
+        const __m128 h_y{ _mm_sub_ps(_mm_add_ps(r.origin_y, _mm_mul_ps(t_lanes, r.dir_y)), _mm_load_ps(q_y)) };
+        const __m128 h_z{ _mm_sub_ps(_mm_add_ps(r.origin_z, _mm_mul_ps(t_lanes, r.dir_z)), _mm_load_ps(q_z)) };
+
+        const __m128 lane_u_x{ _mm_load_ps(u_x) }, lane_u_y{ _mm_load_ps(u_y) }, lane_u_z{ _mm_load_ps(u_z) };
+        const __m128 lane_v_x{ _mm_load_ps(v_x) }, lane_v_y{ _mm_load_ps(v_y) }, lane_v_z{ _mm_load_ps(v_z) };
+        const __m128 lane_w_x{ _mm_load_ps(w_x) }, lane_w_y{ _mm_load_ps(w_y) }, lane_w_z{ _mm_load_ps(w_z) };
+
+        // alpha = dot(w, cross(h, v)), beta = dot(w, cross(u, h))
+        const __m128 hv_x{ _mm_sub_ps(_mm_mul_ps(h_y, lane_v_z), _mm_mul_ps(h_z, lane_v_y)) };
+        const __m128 hv_y{ _mm_sub_ps(_mm_mul_ps(h_z, lane_v_x), _mm_mul_ps(h_x, lane_v_z)) };
+        const __m128 hv_z{ _mm_sub_ps(_mm_mul_ps(h_x, lane_v_y), _mm_mul_ps(h_y, lane_v_x)) };
+        const __m128 alpha_lanes{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(lane_w_x, hv_x), _mm_mul_ps(lane_w_y, hv_y)), _mm_mul_ps(lane_w_z, hv_z)) };
+
+        const __m128 uh_x{ _mm_sub_ps(_mm_mul_ps(lane_u_y, h_z), _mm_mul_ps(lane_u_z, h_y)) };
+        const __m128 uh_y{ _mm_sub_ps(_mm_mul_ps(lane_u_z, h_x), _mm_mul_ps(lane_u_x, h_z)) };
+        const __m128 uh_z{ _mm_sub_ps(_mm_mul_ps(lane_u_x, h_y), _mm_mul_ps(lane_u_y, h_x)) };
+        const __m128 beta_lanes{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(lane_w_x, uh_x), _mm_mul_ps(lane_w_y, uh_y)), _mm_mul_ps(lane_w_z, uh_z)) };
+
+        const __m128 zero{ _mm_setzero_ps() };
+        const __m128 one{ _mm_set1_ps(1.f) };
+        const __m128 interior{ _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(alpha_lanes, zero), _mm_cmple_ps(alpha_lanes, one)),
+            _mm_and_ps(_mm_cmpge_ps(beta_lanes, zero), _mm_cmple_ps(beta_lanes, one))) };
+
+        const int mask{ _mm_movemask_ps(_mm_and_ps(_mm_and_ps(not_parallel, t_inside), interior)) & ((1 << count) - 1) };
+        if (mask == 0)
+            return -1;
+
+        const int lane{ nearest_lane(mask, t_lanes, t) };
+
+        alignas(16) float alpha_values[4];
+        alignas(16) float beta_values[4];
+        _mm_store_ps(alpha_values, alpha_lanes);
+        _mm_store_ps(beta_values, beta_lanes);
+        alpha = alpha_values[lane];
+        beta = beta_values[lane];
+        return lane;
+    }
+};
+#pragma endregion
@@ -2,10 +2,16 @@
 
 #include "entity.hpp"
 #include "entitylist.hpp"
+#include "material.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 #pragma region Quad declaration
 class quad : public entity {
 
+    friend struct quad_block;
+
     point3 Q;
     vec3 u, v;
     vec3 w;
@@ -14,6 +20,21 @@ class quad : public entity {
     vec3 normal;
     float D;
     float area;
+    float spherical_range_squared; // rectangles only (u and v at right angles), 0 for other quads
+
+    // The rectangle as seen from a shading point (Urena et al. 2013, "An Area-Preserving Parametrization for
+    // Spherical Rectangles"): in the frame ex, ey, ez at the point it spans [x0,x1] x [y0,y1] at height z0 <= 0
+    struct spherical_rectangle {
+        vec3 ex, ey, ez;
+        float x0, x1, y0, y1, z0;
+        float b0, b1, k;
+        float solid_angle;
+    };
+
+    // Outside this range the parametrization loses too much precision (tiny or nearly hemispherical
+    // rectangles), area sampling takes over.
+    static constexpr float min_spherical_solid_angle{ 3e-4f };
+    static constexpr float max_spherical_solid_angle{ 6.22f };
 
 public:
 
@@ -25,7 +46,11 @@ public:
         w = n / dot(n, n);
 
         area = n.length();
-        
+        // Past about one diagonal from the center, uniform area is already close to uniform solid angle and
+        // the spherical setup (four acos) costs more than the variance it removes
+        const bool rectangle{ std::fabs(dot(u, v)) <= 1e-4f * u.length() * v.length() };
+        spherical_range_squared = rectangle ? (u + v).squared_length() : 0.f;
+
         set_bounding_box();
     }
 
@@ -37,7 +62,40 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    // One sided, light leaves along the plane normal (front face)
+    void collect_emitters(const affine3& object_to_world, std::vector<emitter>& emitters) const override {
+        const float radiance{ luminance(mat->average_emission()) };
+        if (radiance > 0.f)
+            emitters.push_back(make_emitter(*this, object_to_world, radiance, area, normal, 1.f));
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        float t, alpha, beta;
+        if (!intersect_plane(r, ray_t, t, alpha, beta) || !is_interior(alpha, beta, rec))
+            return false;
+
+        // Ray hits the 2D shape, is_interior already stored the uv.
+        rec.t = t;
+        rec.object = this;
+
+        return true;
+    }
+
+    // Same test with the parallelogram interior check bound statically, used by primitive storage
+    // that knows it holds an exact quad so neither intersect nor is_interior goes through the vtable.
+    bool intersect_parallelogram(const ray& r, interval ray_t, hit_record& rec) const {
+        float t, alpha, beta;
+        if (!intersect_plane(r, ray_t, t, alpha, beta) || !quad::is_interior(alpha, beta, rec))
+            return false;
+
+        rec.t = t;
+        rec.object = this;
+
+        return true;
+    }
+
+    // Plane hit inside ray_t and the hit point in plane coordinates along u and v.
+    bool intersect_plane(const ray& r, interval ray_t, float& t, float& alpha, float& beta) const {
         auto denom{ dot(normal, r.direction()) };
 
         // No hit if the ray is parallel to the plane.
@@ -45,26 +103,23 @@ public:
             return false;
         
         // Return false if the hit point parameter t is outside the ray interval.
-        auto t{ (D - dot(normal, r.origin())) / denom };
+        t = (D - dot(normal, r.origin())) / denom;
         if (!ray_t.contains(t))
             return false;
         
         // Determine if the hit point lies within the planar shape using its plane coordinates.
         auto intersection{ r.at(t) };
         vec3 planar_hitpt_vector{ intersection - Q };
-        auto alpha{ dot(w, cross(planar_hitpt_vector, v)) };
-        auto beta{ dot(w, cross(u, planar_hitpt_vector)) };
+        alpha = dot(w, cross(planar_hitpt_vector, v));
+        beta = dot(w, cross(u, planar_hitpt_vector));
 
-        if (!is_interior(alpha, beta, rec))
-            return false;
+        return true;
+    }
 
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
-        rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
+    void surface_interaction(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.mat = mat.get();
         set_face_normal(rec, r, normal);
-
-        return true;
     }
 
     virtual bool is_interior(float a, float b, hit_record& rec) const {
@@ -80,40 +135,142 @@ public:
         return true;
     }
 
+    // Both densities come from the plane test alone, the light is never intersected as an entity
     float pdf_value(const point3& origin, const vec3& direction) const override {
+        float t, alpha, beta;
         hit_record rec{};
-        if (!this->hit(ray(origin, direction), interval(0.001f, infinity), rec))
+        if (!intersect_plane(ray(origin, direction), interval(0.001f, infinity), t, alpha, beta) || !is_interior(alpha, beta, rec))
             return 0.f;
 
-        float distance_squared{ rec.t * rec.t * direction.squared_length() };
-        float cosine{ std::fabs(dot(direction, rec.normal) / direction.length()) };
+        if (near_enough_for_solid_angle(origin)) {
+            const spherical_rectangle rect{ project(origin) };
+            if (solid_angle_sampled(rect))
+                return 1.f / rect.solid_angle;
+        }
+
+        float distance_squared{ t * t * direction.squared_length() };
+        float cosine{ std::fabs(dot(direction, normal) / direction.length()) };
 
         return distance_squared / (cosine * area);
     }
 
     vec3 random(const point3& origin) const override {
-        auto p{ Q + (random_float() * u) + (random_float() * v) };
-        return p - origin;
+        light_sample sample{};
+        return sample_light(origin, sample) ? sample.direction : vec3(1.f, 0.f, 0.f);
+    }
+
+    bool sample_light(const point3& origin, light_sample& sample) const override {
+        float alpha, beta;
+        if (near_enough_for_solid_angle(origin)) {
+            const spherical_rectangle rect{ project(origin) };
+            if (solid_angle_sampled(rect)) {
+                const point3 p{ sample_spherical_rectangle(rect, origin, random_float(), random_float()) };
+                const vec3 planar{ p - Q };
+                alpha = dot(w, cross(planar, v));
+                beta = dot(w, cross(u, planar));
+                sample.direction = p - origin;
+                sample.distance = sample.direction.length();
+                sample.pdf = 1.f / rect.solid_angle;
+                sample.emitter_pdf = sample.pdf;
+                return finish_light_sample(origin, alpha, beta, sample);
+            }
+        }
+
+        // Uniform over the area, converted to solid angle
+        alpha = random_float();
+        beta = random_float();
+        sample.direction = Q + alpha * u + beta * v - origin;
+        sample.distance = sample.direction.length();
+
+        const float cosine{ std::fabs(dot(sample.direction, normal)) / sample.distance };
+        if (cosine <= 0.f)
+            return false;
+
+        sample.pdf = sample.distance * sample.distance / (cosine * area);
+        sample.emitter_pdf = sample.pdf;
+        return finish_light_sample(origin, alpha, beta, sample);
+    }
+
+private:
+
+    spherical_rectangle project(const point3& origin) const {
+        spherical_rectangle rect{};
+        const float u_length{ u.length() };
+        const float v_length{ v.length() };
+        rect.ex = u / u_length;
+        rect.ey = v / v_length;
+        rect.ez = cross(rect.ex, rect.ey);
+
+        const vec3 to_corner{ Q - origin };
+        rect.x0 = dot(to_corner, rect.ex);
+        rect.y0 = dot(to_corner, rect.ey);
+        rect.z0 = dot(to_corner, rect.ez);
+        if (rect.z0 > 0.f) {
+            rect.z0 = -rect.z0;
+            rect.ez = -rect.ez;
+        }
+        rect.x1 = rect.x0 + u_length;
+        rect.y1 = rect.y0 + v_length;
+
+        // Normals of the planes through the origin and each edge, the interior angles between them give the solid angle
+        const vec3 n0{ unit_vector(vec3(0.f, rect.z0, -rect.y0)) };
+        const vec3 n1{ unit_vector(vec3(-rect.z0, 0.f, rect.x1)) };
+        const vec3 n2{ unit_vector(vec3(0.f, -rect.z0, rect.y1)) };
+        const vec3 n3{ unit_vector(vec3(rect.z0, 0.f, -rect.x0)) };
+        const float g0{ std::acos(std::clamp(-dot(n0, n1), -1.f, 1.f)) };
+        const float g1{ std::acos(std::clamp(-dot(n1, n2), -1.f, 1.f)) };
+        const float g2{ std::acos(std::clamp(-dot(n2, n3), -1.f, 1.f)) };
+        const float g3{ std::acos(std::clamp(-dot(n3, n0), -1.f, 1.f)) };
+
+        rect.b0 = n0.z();
+        rect.b1 = n2.z();
+        rect.k = 2.f * pi - g2 - g3;
+        rect.solid_angle = g0 + g1 - rect.k;
+        return rect;
+    }
+
+    // Depends on the origin only, so pdf_value and sample_light always pick the same density
+    bool near_enough_for_solid_angle(const point3& origin) const {
+        return (Q + 0.5f * (u + v) - origin).squared_length() < spherical_range_squared;
+    }
+
+    // Written so a NaN solid angle (origin on an edge) falls back to area sampling as well
+    static bool solid_angle_sampled(const spherical_rectangle& rect) {
+        return rect.solid_angle >= min_spherical_solid_angle && rect.solid_angle <= max_spherical_solid_angle;
+    }
+
+    // (r1, r2) pick the sub rectangle area and the height inside it, so the point is uniform in solid angle
+    static point3 sample_spherical_rectangle(const spherical_rectangle& rect, const point3& origin, float r1, float r2) {
+        const float au{ r1 * rect.solid_angle + rect.k };
+        const float fu{ (std::cos(au) * rect.b0 - rect.b1) / std::sin(au) };
+        float cu{ (fu > 0.f ? 1.f : -1.f) / std::sqrt(fu * fu + rect.b0 * rect.b0) };
+        cu = std::clamp(cu, -1.f, 1.f);
+
+        float xu{ -(cu * rect.z0) / std::sqrt(std::fmax(1e-12f, 1.f - cu * cu)) };
+        xu = std::clamp(xu, rect.x0, rect.x1);
+
+        const float d{ std::sqrt(xu * xu + rect.z0 * rect.z0) };
+        const float h0{ rect.y0 / std::sqrt(d * d + rect.y0 * rect.y0) };
+        const float h1{ rect.y1 / std::sqrt(d * d + rect.y1 * rect.y1) };
+        const float hv{ h0 + r2 * (h1 - h0) };
+        const float hv2{ hv * hv };
+        const float yv{ hv2 < 1.f - 1e-6f ? (hv * d) / std::sqrt(1.f - hv2) : rect.y1 };
+
+        return origin + xu * rect.ex + std::clamp(yv, rect.y0, rect.y1) * rect.ey + rect.z0 * rect.ez;
+    }
+
+    // Radiance of the sampled point as if a ray from origin had hit it, one sided lights are black from behind
+    bool finish_light_sample(const point3& origin, float alpha, float beta, light_sample& sample) const {
+        const ray to_light{ origin, sample.direction };
+        hit_record rec{};
+        rec.p = origin + sample.direction;
+        rec.t = 1.f;
+        rec.u = alpha;
+        rec.v = beta;
+        rec.mat = mat.get();
+        set_face_normal(rec, to_light, normal);
+        sample.emitted = mat->emitted(to_light, rec, alpha, beta, rec.p);
+        return true;
     }
 };
 #pragma endregion
-
-__forceinline std::shared_ptr<entity_list> box(const point3& a, const point3& b, std::shared_ptr<material> mat) {
-    auto sides{ std::make_shared<entity_list>() };
-
-    auto min{ point3(std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z())) };
-    auto max{ point3(std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z())) };
-    
-    auto dx{ vec3(max.x() - min.x(), 0.f, 0.f) };
-    auto dy{ vec3(0.f, max.y() - min.y(), 0.f) };
-    auto dz{ vec3(0.f, 0.f, max.z() - min.z()) };
-
-    sides->add(std::make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
-    sides->add(std::make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
-    sides->add(std::make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
-    sides->add(std::make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
-    sides->add(std::make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
-    sides->add(std::make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
-
-    return sides;
-}
\ No newline at end of file
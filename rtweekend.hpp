@@ -1,32 +1,212 @@
 #pragma once
+#include <array>
+#include <cstdint>
 #include <numbers>
-#include <random>
 
 // Because as a dev I'm lazy and don't want to type std::numbers::pi_v<float> every time i want to use pi as a float
 constexpr const float pi{ std::numbers::pi_v<float> };
 
-inline std::mt19937& get_generator() {
-    static std::mt19937 generator(std::random_device{}());
+#pragma region counter based random generator
+// PCG32 (O'Neill), 16 bytes of state so every worker owns its generator on its own stack/TLS line.
+class pcg32 {
+
+    uint64_t state{};
+    uint64_t increment{};
+
+public:
+
+    pcg32(uint64_t seed = 0x853c'49e6'748f'ea9bull, uint64_t stream = 0xda3e'39cb'94b9'5bdbull) { reseed(seed, stream); }
+
+    __forceinline void reseed(uint64_t seed, uint64_t stream) {
+        state = 0u;
+        increment = (stream << 1u) | 1u;
+        next_u32();
+        state += seed;
+        next_u32();
+    }
+
+    __forceinline uint32_t next_u32() {
+        uint64_t old_state{ state };
+        state = old_state * 6364136223846793005ull + increment;
+        auto xorshifted{ static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u) };
+        auto rotation{ static_cast<uint32_t>(old_state >> 59u) };
+        return (xorshifted >> rotation) | (xorshifted << ((32u - rotation) & 31u));
+    }
+};
+#pragma endregion
+
+// SplitMix64 finalizer, turns structured keys (seed, pixel, sample, bounce) into well spread generator seeds
+__forceinline uint64_t mix_bits(uint64_t v) {
+    v ^= v >> 31;
+    v *= 0x7fb5'd329'728e'a185ull;
+    v ^= v >> 27;
+    v *= 0x81da'def4'bc2d'd44dull;
+    v ^= v >> 33;
+    return v;
+}
+
+// Every thread owns its generator, nothing is shared between workers.
+// Threads that never call begin_sample_random (scene construction on the main thread) get the fixed default
+// seed so generated scenes are reproducible too.
+inline pcg32& get_generator() {
+    thread_local pcg32 generator{};
     return generator;
 }
 
+#pragma region sample streams
+// Where the numbers of a sample come from. Draws are numbered as dimensions: a block for the camera ray, then one
+// block per bounce, each bounce starting at its block no matter how many draws the previous one took. Draws past
+// the end of a block (rejection loops, deep light trees) and every draw of the independent sampler come from the
+// generator.
+enum class sampler_kind {
+    independent,    // PCG32 for every draw
+    sobol           // Owen scrambled, shuffled 2D Sobol pairs padded per dimension pair (Burley 2020), PCG32 past a block
+};
+
+constexpr uint32_t camera_dimensions{ 8 };
+constexpr uint32_t bounce_dimensions{ 8 };
+
+struct sample_stream {
+    uint64_t sample_key{};  // (seed, pixel, sample), keys the generator
+    uint64_t pixel_key{};   // (seed, pixel), keys the scrambles so a pixel's samples form one sequence
+    uint32_t sample_index{};
+    uint32_t dimension{};
+    uint32_t dimension_end{}; // dimension stays below it while draws come from the sequence, 0 for independent
+    sampler_kind sampler{ sampler_kind::independent };
+
+    // Shuffled index and the two scramble seeds of the current dimension pair, set on its first (even) dimension
+    uint32_t pair_index{};
+    uint32_t pair_scramble[2]{};
+};
+
+inline sample_stream& current_sample_stream() {
+    thread_local sample_stream stream{};
+    return stream;
+}
+
+__forceinline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x5555'5555u) | ((x & 0x5555'5555u) << 1);
+    x = ((x >> 2) & 0x3333'3333u) | ((x & 0x3333'3333u) << 2);
+    x = ((x >> 4) & 0x0f0f'0f0fu) | ((x & 0x0f0f'0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff'00ffu) | ((x & 0x00ff'00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras permutation, constants from Burley 2020, "Practical Hash-based Owen Scrambling". Every bit is flipped
+// depending only on the bits below it, so on a bit reversed value it is an Owen scramble.
+__forceinline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50'b47cu;
+    x ^= x * 0xb82f'1e52u;
+    x ^= x * 0xc7af'e638u;
+    x ^= x * 0x8d22'f6e6u;
+    return x;
+}
+
+__forceinline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// Second Sobol dimension's generator matrix applied a byte at a time, a bit serial loop mispredicts on every index.
+// Entries are bit reversed, scrambling wants the reversed value and reversal distributes over xor.
+inline constexpr auto sobol_second_dimension_table{ [] {
+    std::array<uint32_t, 32> directions{};
+    directions[0] = 1u;
+    for (int bit{ 1 }; bit < 32; ++bit)
+        directions[bit] = directions[bit - 1] ^ (directions[bit - 1] << 1);
+
+    std::array<std::array<uint32_t, 256>, 4> table{};
+    for (int byte{ 0 }; byte < 4; ++byte)
+        for (uint32_t value{ 0 }; value < 256; ++value)
+            for (int bit{ 0 }; bit < 8; ++bit)
+                if (value & (1u << bit))
+                    table[byte][value] ^= directions[byte * 8 + bit];
+    return table;
+}() };
+
+// Bit reversed second dimension point, the first dimension's reversed point is the index itself
+__forceinline uint32_t sobol_second_dimension_reversed(uint32_t index) {
+    return sobol_second_dimension_table[0][index & 0xffu] ^ sobol_second_dimension_table[1][(index >> 8) & 0xffu]
+        ^ sobol_second_dimension_table[2][(index >> 16) & 0xffu] ^ sobol_second_dimension_table[3][index >> 24];
+}
+
+// Dimensions 2k and 2k+1 are one scrambled 2D Sobol sequence over the pixel's samples, a shuffle of the sample
+// index decorrelates the pairs from each other. Any prefix of 2^m samples stays stratified in every pair.
+__forceinline void begin_sobol_pair(sample_stream& stream, uint32_t pair) {
+    const uint64_t pair_key{ mix_bits(stream.pixel_key + pair) };
+    stream.pair_index = nested_uniform_scramble(stream.sample_index, static_cast<uint32_t>(pair_key));
+    stream.pair_scramble[0] = static_cast<uint32_t>(pair_key >> 32);
+    stream.pair_scramble[1] = static_cast<uint32_t>(mix_bits(pair_key));
+}
+
+// Owen scrambled point, nested_uniform_scramble with the reversals folded into the point construction
+__forceinline uint32_t sobol_pair_u32(const sample_stream& stream, uint32_t component) {
+    const uint32_t reversed_point{ component ? sobol_second_dimension_reversed(stream.pair_index) : stream.pair_index };
+    return reverse_bits(laine_karras_permutation(reversed_point, stream.pair_scramble[component]));
+}
+#pragma endregion
+
+// Restarts the generator from (seed, pixel, sample index). Random numbers drawn for a sample depend only on
+// that key, never on which thread renders it or in which order tiles are scheduled.
+__forceinline void begin_sample_random(uint32_t seed, uint32_t pixel_index, uint32_t sample_index,
+    sampler_kind sampler = sampler_kind::independent) {
+    sample_stream& stream{ current_sample_stream() };
+    stream.pixel_key = mix_bits((static_cast<uint64_t>(seed) << 32) | pixel_index);
+    stream.sample_key = mix_bits(stream.pixel_key ^ sample_index);
+    stream.sample_index = sample_index;
+    stream.sampler = sampler;
+    stream.dimension = 0u;
+    stream.dimension_end = sampler == sampler_kind::independent ? 0u : camera_dimensions;
+    get_generator().reseed(stream.sample_key, 0u);
+}
+
+// Restarts the generator for a path vertex so a bounce consumes the same numbers no matter how many
+// the previous bounce used (rejection sampling loops, etc.).
+__forceinline void begin_bounce_random(uint32_t bounce) {
+    sample_stream& stream{ current_sample_stream() };
+    uint64_t key{ mix_bits(stream.sample_key + bounce + 1u) };
+    get_generator().reseed(key, bounce + 1u);
+
+    if (stream.sampler != sampler_kind::independent) {
+        stream.dimension = camera_dimensions + bounce * bounce_dimensions;
+        stream.dimension_end = stream.dimension + bounce_dimensions;
+    }
+}
+
+// Next draw of the current sample, from the sampler while its block lasts
+__forceinline uint32_t next_sample_u32() {
+    sample_stream& stream{ current_sample_stream() };
+    if (stream.dimension < stream.dimension_end) {
+        const uint32_t dimension{ stream.dimension++ };
+        if ((dimension & 1u) == 0u)
+            begin_sobol_pair(stream, dimension >> 1); // blocks start even, so the odd half always follows
+        return sobol_pair_u32(stream, dimension & 1u);
+    }
+    return get_generator().next_u32();
+}
+
 __forceinline float degrees_to_radians(float degrees) {
     return degrees * pi / 180.0f;
 }
 
 __forceinline int random_int(int min = 0, int max = 1) {
-    std::uniform_int_distribution<int> distribution(min, max);
-    return distribution(get_generator());
+    // Lemire's multiply-shift range reduction, inclusive range [min, max]
+    auto range{ static_cast<uint64_t>(static_cast<int64_t>(max) - min + 1) };
+    return min + static_cast<int>((next_sample_u32() * range) >> 32);
 }
 
 __forceinline float random_float(float min = 0.0f, float max = 1.0f) {
-    std::uniform_real_distribution<float> distribution(min, max);
-    return distribution(get_generator());
+    // 24 random mantissa bits, uniform in [0, 1)
+    float unit{ (next_sample_u32() >> 8) * 0x1.0p-24f };
+    return min + (max - min) * unit;
 }
 
 __forceinline double random_double(double min = 0.0, double max = 1.0) {
-    std::uniform_real_distribution<double> distribution(min, max);
-    return distribution(get_generator());
+    // 53 random mantissa bits, uniform in [0, 1). One sample dimension, the generator fills the low bits.
+    uint64_t high{ next_sample_u32() >> 5 };
+    uint64_t low{ get_generator().next_u32() >> 6 };
+    double unit{ static_cast<double>((high << 26) | low) * 0x1.0p-53 };
+    return min + (max - min) * unit;
 }
 
 #include "interval.hpp"
@@ -6,8 +6,10 @@
 #include <algorithm>
 #include <cctype>
 #include <regex>
+#include <sstream>
 
 #include "scenes.hpp"
+#include "accumulation_file.hpp"
 
 struct scene_option {
     int id;
@@ -28,6 +30,9 @@ const std::vector<scene_option> scenes {
     , {10, "2'nd Book final scene (high)", "high"}
 };
 
+// Not a scene, combines accumulation files rendered elsewhere
+constexpr int merge_choice{ -1 };
+
 std::string to_lower(const std::string& str) {
     std::string result = str;
     std::transform(result.begin(), result.end(), result.begin(),
@@ -77,6 +82,7 @@ int get_scene_choice() {
         for (const auto& scene : scenes) {
             std::cout << scene.id << ". " << scene.name << "\n";
         }
+        std::clog << "merge. Combine accumulation files\n";
         std::clog << "0. Exit\n";
         std::clog << "Enter scene number: ";
 
@@ -87,6 +93,10 @@ int get_scene_choice() {
             return 0;
         }
 
+        if (to_lower(input) == "merge") {
+            return merge_choice;
+        }
+
         if (is_number(input)) {
             int choice = std::stoi(input);
             if (choice >= 0 && choice <= static_cast<int>(scenes.size())) {
@@ -132,7 +142,7 @@ int get_scene_choice() {
     }
 }
 
-auto render_scene(int scene_id, int _sample_count) -> int {
+auto render_scene(int scene_id, int _sample_count, const std::string& checkpoint_file = {}) -> int {
 
     if (scene_id == 0) {
         return 0;
@@ -162,9 +172,9 @@ auto render_scene(int scene_id, int _sample_count) -> int {
                 case 8:
                     return cornell_smoke();
                 case 9:
-                    return final_scene(400,   250,  4);
+                    return final_scene(400,   250,  4, checkpoint_file);
                 case 10:
-                    return final_scene(800, 10'000, 40);
+                    return final_scene(800, 10'000, 40, checkpoint_file);
                     
             }
             
@@ -197,6 +207,40 @@ auto get_sample_count() -> int {
     }
 }
 
+// Only the final scenes take long enough to be worth checkpointing
+bool takes_checkpoints(int scene_id) {
+    return scene_id == 9 || scene_id == 10;
+}
+
+auto get_checkpoint_file() -> std::string {
+    std::cout << "Checkpoint file to resume and keep updated (empty for none): ";
+    std::string input;
+    std::getline(std::cin, input);
+    return input;
+}
+
+auto merge_renders() -> int {
+    std::cout << "Accumulation files to merge (separated by spaces): ";
+    std::string input;
+    std::getline(std::cin, input);
+
+    std::vector<std::string> inputs;
+    std::istringstream names(input);
+    for (std::string name; names >> name;)
+        inputs.push_back(name);
+
+    if (inputs.size() < 2) {
+        std::cout << "\033[1;31mNeed at least two files to merge.\033[0m\n";
+        return 1;
+    }
+
+    if (!merge_accumulation_files(inputs, "merged.acc", "merged.ppm")) {
+        std::cerr << "\033[1;31mERROR:\033[0m merge failed\n";
+        return 1;
+    }
+    return 0;
+}
+
 auto scene_selection() -> int {
     bool running{ true };
 
@@ -209,9 +253,12 @@ auto scene_selection() -> int {
         if (scene_choice == 0) {
             std::cout << "Exiting program. Goodbye!\n";
             running = false;
+        } else if (scene_choice == merge_choice) {
+            res = merge_renders();
         } else {
             int sample_count{ get_sample_count() };
-            res = render_scene(scene_choice, sample_count);
+            std::string checkpoint_file{ takes_checkpoints(scene_choice) ? get_checkpoint_file() : std::string{} };
+            res = render_scene(scene_choice, sample_count, checkpoint_file);
         }
     }
 
@@ -16,10 +16,19 @@
 #include "entitylist.hpp"
 #include "sphere.hpp"
 #include "bvh.hpp"
+#include "wide_bvh.hpp"
+#include "transform.hpp"
 #include "texture.hpp"
 #include "quad.hpp"
+#include "box.hpp"
 #include "constant_medium.hpp"
 
+// SAH options for the scenes' BVHs, moving primitives get box bounds at the camera's shutter open and close
+// instead of their swept boxes
+bvh_build_options sah_build_options(const camera& cam) {
+    return bvh_build_options{ .split_method = bvh_split_method::sah, .max_leaf_primitives = 4, .shutter = cam.shutter() };
+}
+
 auto bouncing_spheres() -> int
 {
     entity_list world{};
@@ -110,12 +119,6 @@ auto bouncing_spheres() -> int
         }
     }
 
-    world = entity_list(std::make_shared<bvh_node>(world));
-
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(3.f,1.f,-2.f), vec3(2.f,0.f,0.f), vec3(0.f,2.f,0.f), empty_material);
-
     camera cam;
 
     cam.aspect_ratio      = 16.0 / 10.0;
@@ -132,8 +135,10 @@ auto bouncing_spheres() -> int
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
 
+    world = entity_list(std::make_shared<bvh4>(world, sah_build_options(cam)));
+
     try {
-        cam.render(world, lightsource);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31ERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -157,10 +162,6 @@ auto two_spheres_scene() -> int {
     world.add(std::make_shared<sphere>(point3(0.f,-10.f, 0.f), 10.f, std::make_shared<lambertian>(checker)));
     world.add(std::make_shared<sphere>(point3(0.f, 10.f, 0.f), 10.f, std::make_shared<lambertian>(checker)));
 
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(3.f,1.f,-2.f), vec3(2.f,0.f,0.f), vec3(0.f,2.f,0.f), empty_material);
-
     camera cam;
 
     cam.aspect_ratio      = 16.0 / 10.0;
@@ -177,7 +178,7 @@ auto two_spheres_scene() -> int {
     cam.defocus_angle = 0;
 
     try {
-        cam.render(world, lightsource);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -198,10 +199,6 @@ auto earth() -> int {
     auto earth_surface = std::make_shared<lambertian>(earth_texture);
     auto globe = std::make_shared<sphere>(point3(0.f,0.f,0.f), 2.f, earth_surface);
 
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(3.f,1.f,-2.f), vec3(2.f,0.f,0.f), vec3(0.f,2.f,0.f), empty_material);
-
     camera cam;
 
     cam.aspect_ratio      = 16.0f / 9.0f;
@@ -219,7 +216,7 @@ auto earth() -> int {
 
     
     try {
-        cam.render(entity_list(globe), lightsource);
+        cam.render(entity_list(globe));
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -242,10 +239,6 @@ auto perlin_spheres() -> int{
     world.add(std::make_shared<sphere>(point3(0.f,-1000.f,0.f), 1000.f, std::make_shared<lambertian>(pertext)));
     world.add(std::make_shared<sphere>(point3(0.f,2.f,0.f), 2.f, std::make_shared<lambertian>(pertext)));
 
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(3.f,1.f,-2.f), vec3(2.f,0.f,0.f), vec3(0.f,2.f,0.f), empty_material);
-
     camera cam;
 
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -262,7 +255,7 @@ auto perlin_spheres() -> int{
     cam.defocus_angle = 0.f;
 
     try {
-        cam.render(world, lightsource);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -295,10 +288,6 @@ auto quads() -> int {
     world.add(std::make_shared<quad>(point3(-2.f, 3.f, 1.f), vec3(4.f, 0.f, 0.f), vec3(0.f, 0.f, 4.f), upper_orange));
     world.add(std::make_shared<quad>(point3(-2.f,-3.f, 5.f), vec3(4.f, 0.f, 0.f), vec3(0.f, 0.f,-4.f), lower_teal));
 
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(3.f,1.f,-2.f), vec3(2.f,0.f,0.f), vec3(0.f,2.f,0.f), empty_material);
-
     camera cam;
 
     cam.aspect_ratio      = 1.0f;
@@ -315,7 +304,7 @@ auto quads() -> int {
     cam.defocus_angle = 0.f;
 
     try {
-        cam.render(world, lightsource);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -342,10 +331,6 @@ auto simple_light() -> int {
     world.add(std::make_shared<sphere>(point3(0.f,7.f,0.f), 2.f, difflight));
     world.add(std::make_shared<quad>(point3(3.f,1.f,-2.f), vec3(2.f,0.f,0.f), vec3(0.f,2.f,0.f), difflight));
 
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(3.f,1.f,-2.f), vec3(2.f,0.f,0.f), vec3(0.f,2.f,0.f), empty_material);
-
     camera cam;
 
     cam.aspect_ratio      = 16.0f / 9.0f;
@@ -360,9 +345,10 @@ auto simple_light() -> int {
     cam.vup      = vec3(0.f,1.f,0.f);
 
     cam.defocus_angle = 0.f;
+    cam.integrator    = integrator_mode::nee_mis;
 
     try {
-        cam.render(world, lightsource);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -388,7 +374,6 @@ auto cornell_box(int _samples_per_pixel = 200) -> int {
     auto light = std::make_shared<diffuse_light>(color(15.f, 15.f, 15.f));
     auto aluminum = std::make_shared<metalic>(color(0.8f, 0.85f, 0.88f), 0.0f);
     auto glass = std::make_shared<dielectric>(1.5f);
-    auto empty_material{ std::make_shared<material>() };
 
     world.add(std::make_shared<quad>(point3(555.f,0.f,0.f), vec3(0.f,555.f,0.f), vec3(0.f,0.f,555.f), green));
     world.add(std::make_shared<quad>(point3(0.f,0.f,0.f), vec3(0.f,555.f,0.f), vec3(0.f,0.f,555.f), red));
@@ -410,10 +395,6 @@ auto cornell_box(int _samples_per_pixel = 200) -> int {
     // world.add(box2);
     world.add(std::make_shared<sphere>(point3(190.f, 90.f, 190.f), 90.f, glass));
     
-    entity_list lights;
-    lights.add(std::make_shared<quad>(point3(343.f, 554.f, 332.f), vec3(-130.f,0.f,0.f), vec3(0.f,0.f,-105.f), empty_material));
-    lights.add(std::make_shared<sphere>(point3(190.f, 90.f, 190.f), 90.f, empty_material));
-
     camera cam;
 
     cam.aspect_ratio      = 1.0f;
@@ -428,9 +409,10 @@ auto cornell_box(int _samples_per_pixel = 200) -> int {
     cam.vup      = vec3(0.f,1.f,0.f);
 
     cam.defocus_angle = 0.f;
+    cam.integrator    = integrator_mode::nee_mis;
 
     try {
-        cam.render(world, lights);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -472,10 +454,6 @@ auto cornell_smoke() -> int {
     world.add(std::make_shared<constant_medium>(box1, 0.01f, color(0.f,0.f,0.f)));
     world.add(std::make_shared<constant_medium>(box2, 0.01f, color(1.f,1.f,1.f)));
 
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(113.f,554.f,127.f), vec3(330.f,0.f,0.f), vec3(0.f,0.f,305.f), empty_material);
-
     camera cam;
 
     cam.aspect_ratio      = 1.0f;
@@ -492,7 +470,7 @@ auto cornell_smoke() -> int {
     cam.defocus_angle = 0.f;
 
     try {
-        cam.render(world, lightsource);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
@@ -508,7 +486,14 @@ auto cornell_smoke() -> int {
     return 0;
 }
 
-auto final_scene(int image_width, int samples_per_pixel, int max_depth) -> int {
+auto final_scene(int image_width, int samples_per_pixel, int max_depth, const std::string& checkpoint_file = {}) -> int {
+    // Set before the BVHs are built, their motion bounds follow the shutter
+    camera cam;
+    cam.shuter_speed = .16;
+
+    // Uneven ground boxes and a loose sphere cluster, median splits build poor trees here
+    const bvh_build_options sah_options{ sah_build_options(cam) };
+
     entity_list boxes1;
     auto ground = std::make_shared<lambertian>(color(0.48f, 0.83f, 0.53f));
 
@@ -529,13 +514,13 @@ auto final_scene(int image_width, int samples_per_pixel, int max_depth) -> int {
 
     entity_list world;
 
-    world.add(std::make_shared<bvh_node>(boxes1));
+    world.add(std::make_shared<bvh4>(boxes1, sah_options));
 
     auto light = std::make_shared<diffuse_light>(color(7.f, 7.f, 7.f));
     world.add(std::make_shared<quad>(point3(123.f,554.f,147.f), vec3(300.f,0.f,0.f), vec3(0.f,0.f,265.f), light));
 
     auto center1 = point3(400.f, 400.f, 200.f);
-    auto center2 = center1 + vec3(30.f,0.f,0.f);
+    auto center2 = center1 + vec3(30.f,0.f,0.f) / 0.16f; // 30 units while the 0.16 shutter is open
     auto sphere_material = std::make_shared<lambertian>(color(0.7f, 0.3f, 0.1f));
     world.add(std::make_shared<sphere>(center1, center2, 50.f, sphere_material));
 
@@ -564,23 +549,16 @@ auto final_scene(int image_width, int samples_per_pixel, int max_depth) -> int {
 
     world.add(std::make_shared<translate>(
         std::make_shared<rotate_y>(
-            std::make_shared<bvh_node>(boxes2), 15.f),
+            std::make_shared<bvh4>(boxes2, sah_options), 15.f),
             vec3(-100.f, 270.f, 395.f)
         )
     );
 
-    // Light Sources
-    auto empty_material{ std::make_shared<material>() };
-    quad lightsource(point3(343.f, 554.f, 332.f), vec3(-130.f,0.f,0.f), vec3(0.f,0.f,-105.f), empty_material);
-
-    camera cam;
-
     cam.aspect_ratio      = 1.0f;
     cam.image_width       = image_width;
     cam.samples_per_pixel = samples_per_pixel;
     cam.max_depth         = max_depth;
     cam.background        = color(0.f,0.,0.f);
-    cam.shuter_speed      = .16;
 
     cam.vfov     = 40.f;
     cam.lookfrom = point3(478.f, 278.f, -600.f);
@@ -589,8 +567,12 @@ auto final_scene(int image_width, int samples_per_pixel, int max_depth) -> int {
 
     cam.defocus_angle = 0.f;
 
+    // Hours at full quality, with a checkpoint a killed run picks up where it stopped
+    cam.checkpoint_file = checkpoint_file;
+    cam.scene_name      = "final_scene";
+
     try {
-        cam.render(world, lightsource);
+        cam.render(world);
     } catch (const std::exception& e) {
         std::cerr << "\033[1;31mERROR:\033[0m " << e.what() << std::endl;
         std::cout << "Press Enter to exit..." << std::endl;
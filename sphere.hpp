@@ -1,11 +1,14 @@
 #pragma once
 #include "aabb.hpp"
 #include "entity.hpp"
+#include "material.hpp"
 #include "onb.hpp"
 #include "ray.hpp"
 
 #pragma region declaration of sphere
 class sphere : public entity {
+
+    friend struct sphere_block;
     
     ray center;
     float radius{};
@@ -20,15 +23,12 @@ class sphere : public entity {
         v = theta / pi;
     }
 
-    static vec3 ramdom_to_sphere(float radius, float distance_squared) {
-        auto r1{ random_float() };
-        auto r2{ random_float() };
-        auto z{ 1 + r2 * (std::sqrt(1 - radius * radius / distance_squared) - 1) };
+    // 1 - cos(theta_max) of the cone the sphere covers, below sin^2 of about 1.5 degrees the series form keeps
+    // small or distant lights from cancelling to zero in float
+    static constexpr float small_cone_sin2{ 0.00068523f };
 
-        auto phi{ 2 * pi * r1 };
-        auto x{ std::cos(phi) * std::sqrt(1 - z * z) };
-        auto y{ std::sin(phi) * std::sqrt(1 - z * z) };
-        return vec3(x, y, z);
+    static float cone_one_minus_cos(float sin2_theta_max) {
+        return sin2_theta_max < small_cone_sin2 ? 0.5f * sin2_theta_max : 1.f - std::sqrt(1.f - sin2_theta_max);
     }
 
 public:
@@ -54,43 +54,55 @@ public:
             bbox = aabb(box1, box2);
         };
 
-    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
+    virtual bool intersect(const ray& r, interval ray_t, hit_record& rec) const override;
+
+    void surface_interaction(const ray& r, hit_record& rec) const override;
 
+    // Swept box over time [0,1], the motion BVH asks for the box at its shutter times instead
     aabb bounding_box() const override { return bbox; }
 
+    void collect_emitters(const affine3& object_to_world, std::vector<emitter>& emitters) const override {
+        const float radiance{ luminance(mat->average_emission()) };
+        if (radiance > 0.f)
+            emitters.push_back(make_emitter(*this, object_to_world, radiance, 4.f * pi * radius * radius, vec3(0.f, 0.f, 1.f), -1.f));
+    }
+
+    aabb bounding_box_at(float time) const override {
+        auto rvec{ vec3(radius, radius, radius) };
+        return aabb{ center_at_time(time) - rvec, center_at_time(time) + rvec };
+    }
+
+    // Moving spheres are at center1 at time 0 and center2 at time 1, in the same units as the camera shutter
     point3 center_at_time(float time) const {
-        // Normalize the time to [0,1] range based on the expected time range
-        // If your shutter speed is 0.16, this would normalize times from [0,0.16] to [0,1]
-        float normalized_time = time / 0.16;
-        return center.at(normalized_time);
+        return center.at(time);
     }
 
+    // Uniform over the cone the sphere covers from origin, both stay with the center at time 0 (stationary lights).
+    // Nothing is intersected: the direction is inside the cone when its line passes within radius of the center.
     float pdf_value(const point3& origin, const vec3& direction) const override {
-        // This method only works for stationary spheres. For moving spheres, we would need to account for the sphere's position at the time of intersection.
-        hit_record rec{};
-        if (!this->hit(ray(origin, direction), interval(0.001f, infinity), rec))
+        const vec3 to_center{ center_at_time(0) - origin };
+        const float distance_squared{ to_center.squared_length() };
+        const float radius_squared{ radius * radius };
+        if (distance_squared <= radius_squared || dot(to_center, direction) <= 0.f)
             return 0.f;
-        
-        auto dist_squared{ (center_at_time(0) - origin).squared_length() };
-        auto cos_theta_max{ std::sqrt(1 - radius * radius / dist_squared) };
-        auto solid_angle{ 2 * pi * (1 - cos_theta_max) };
 
-        return 1 / solid_angle;
+        if (cross(to_center, direction).squared_length() > radius_squared * direction.squared_length())
+            return 0.f;
+
+        return 1.f / (2.f * pi * cone_one_minus_cos(radius_squared / distance_squared));
     }
 
     vec3 random(const point3& origin) const override {
-        vec3 direction_to_center{ center_at_time(0) - origin };
-        auto distance_squared{ direction_to_center.squared_length() };
-        onb uvw{ direction_to_center };
-        return uvw.transform(ramdom_to_sphere(radius, distance_squared));
+        light_sample sample{};
+        return sample_light(origin, sample) ? sample.direction : vec3(1.f, 0.f, 0.f);
     }
-    
+
+    bool sample_light(const point3& origin, light_sample& sample) const override;
 };
 #pragma endregion
 
-bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
-    // point3 current_center{ center.at(r.time()) };
-    point3 current_center{ center_at_time(r.time()) }; // normalized because of change in random number gen
+bool sphere::intersect(const ray& r, interval ray_t, hit_record& rec) const {
+    point3 current_center{ center_at_time(r.time()) };
     vec3 oc{ r.origin() - current_center }; // it needs to stay in this order otherwise its not rendering
     auto a{ r.direction().squared_length() };
     float half_b{ dot(oc, r.direction()) };
@@ -109,11 +121,63 @@ bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
     }
 
     rec.t = root;
+    rec.object = this;
+    
+    return true;
+}
+
+// Direction uniform in the cone, then the angle alpha at the center, measured from the direction back to origin,
+// places the visible point the direction lands on without intersecting anything
+bool sphere::sample_light(const point3& origin, light_sample& sample) const {
+    const point3 current_center{ center_at_time(0) };
+    const vec3 to_center{ current_center - origin };
+    const float distance_squared{ to_center.squared_length() };
+    const float radius_squared{ radius * radius };
+    if (distance_squared <= radius_squared)
+        return false;
+
+    const float sin2_theta_max{ radius_squared / distance_squared };
+    const float sin_theta_max{ std::sqrt(sin2_theta_max) };
+    const float one_minus_cos_theta_max{ cone_one_minus_cos(sin2_theta_max) };
+
+    float cos_theta, sin2_theta;
+    if (sin2_theta_max < small_cone_sin2) {
+        sin2_theta = sin2_theta_max * random_float();
+        cos_theta = std::sqrt(1.f - sin2_theta);
+    } else {
+        cos_theta = 1.f - random_float() * one_minus_cos_theta_max;
+        sin2_theta = 1.f - cos_theta * cos_theta;
+    }
+
+    const float cos_alpha{ sin2_theta / sin_theta_max + cos_theta * std::sqrt(std::fmax(0.f, 1.f - sin2_theta / sin2_theta_max)) };
+    const float sin_alpha{ std::sqrt(std::fmax(0.f, 1.f - cos_alpha * cos_alpha)) };
+    const float phi{ 2.f * pi * random_float() };
+
+    const onb uvw{ -to_center };
+    const vec3 outward_normal{ uvw.transform(vec3(std::cos(phi) * sin_alpha, std::sin(phi) * sin_alpha, cos_alpha)) };
+    const point3 p{ current_center + radius * outward_normal };
+
+    sample.direction = p - origin;
+    sample.distance = sample.direction.length();
+    sample.pdf = 1.f / (2.f * pi * one_minus_cos_theta_max);
+    sample.emitter_pdf = sample.pdf;
+
+    const ray to_light{ origin, sample.direction };
+    hit_record rec{};
+    rec.p = p;
+    rec.t = 1.f;
+    set_face_normal(rec, to_light, outward_normal);
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat = mat.get();
+    sample.emitted = mat->emitted(to_light, rec, rec.u, rec.v, p);
+    return true;
+}
+
+void sphere::surface_interaction(const ray& r, hit_record& rec) const {
+    point3 current_center{ center_at_time(r.time()) };
     rec.p = r.at(rec.t);
     vec3 outward_normal{ ( rec.p - current_center) / radius };
     set_face_normal(rec, r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
-    rec.mat = mat;
-    
-    return true;
+    rec.mat = mat.get();
 }
\ No newline at end of file
@@ -192,6 +192,7 @@ public:
 
 #pragma endregion
 
+#include <chrono>
 #include <cstdint>
 #include <future>
 #include <type_traits>
@@ -247,10 +248,12 @@ class thread_pool_ws
 
 public:
 
-    thread_pool_ws() : done{false}, joiner{threads}
+    explicit thread_pool_ws(const char* purpose = "rendering") : done{false}, joiner{threads}
     {
-        uint64_t const thread_count{ std::max(std::thread::hardware_concurrency() - 2u, 1u) };
-        std::clog << "\033[1;92mUsing " << thread_count << " threads for rendering.\033[0m\n";
+        // Leave two cores for the preview window and the OS, guard against unsigned wrap on small machines
+        unsigned const hardware_threads{ std::thread::hardware_concurrency() };
+        uint64_t const thread_count{ hardware_threads > 3u ? hardware_threads - 2u : 1u };
+        std::clog << "\033[1;92mUsing " << thread_count << " threads for " << purpose << ".\033[0m\n";
         try
         {
             for (size_t i {0}; i < thread_count; ++i)
@@ -291,6 +294,19 @@ public:
         return res;
     }
 
+    size_t thread_count() const { return threads.size(); }
+
+    // Waiting from inside a task would block a worker the waited for task may need,
+    // so the waiting thread keeps draining the queues until its future is ready.
+    template <typename Result_type>
+    void wait_for(std::future<Result_type>& future)
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            run_pending_task();
+        }
+    }
+
     void run_pending_task()
     {
         task_type task;
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "affine.hpp"
+#include "entity.hpp"
+#include "ray.hpp"
+#include "rtweekend.hpp"
+#include "vec3.hpp"
+
+#include <cmath>
+#include <memory>
+#include <typeinfo>
+
+#pragma region instance
+// Places a shared bottom level structure (usually a bvh_node / bvh4 over the object's primitives) in the world.
+// Any number of instances can reference the same BLAS, a top level BVH built over the instances only stores
+// their bounds. The ray is taken to object space without normalizing the direction, so t stays valid in both spaces.
+// Wrapping a plain instance (translate and rotate_y included) folds both transforms into one at construction,
+// so a chain like translate(rotate_y(bvh)) moves each ray once with one matrix.
+class instance : public entity {
+
+    std::shared_ptr<entity> blas;
+    affine3 object_to_world;
+    affine3 world_to_object;
+    aabb bbox;
+
+public:
+
+    instance(std::shared_ptr<entity> object, const affine3& transform);
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        const ray object_r{
+            world_to_object.transform_point(r.origin()),
+            world_to_object.transform_vector(r.direction()),
+            r.time()
+        };
+
+        if (!blas->hit(object_r, ray_t, rec))
+            return false;
+
+        // front_face survives the transform, dot(M d, M^-T n) == dot(d, n)
+        rec.p = object_to_world.transform_point(rec.p);
+        rec.normal = unit_vector(world_to_object.transform_normal(rec.normal));
+        rec.object = this;
+
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        const ray object_r{
+            world_to_object.transform_point(r.origin()),
+            world_to_object.transform_vector(r.direction()),
+            r.time()
+        };
+        return blas->occluded(object_r, ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void collect_emitters(const affine3& parent_to_world, std::vector<emitter>& emitters) const override {
+        blas->collect_emitters(parent_to_world * object_to_world, emitters);
+    }
+
+    aabb bounding_box_at(float time) const override {
+        return object_to_world.transform_box(blas->bounding_box_at(time));
+    }
+
+    // The blas answers per unit solid angle of object space, scaled and sheared instances change the solid angle
+    float pdf_value(const point3& origin, const vec3& direction) const override {
+        const float pdf{ blas->pdf_value(world_to_object.transform_point(origin), world_to_object.transform_vector(direction)) };
+        return pdf > 0.f ? pdf * world_to_object.solid_angle_jacobian(direction) : 0.f;
+    }
+
+    float emitter_pdf_value(const point3& origin, const vec3& direction) const override {
+        const float pdf{ blas->emitter_pdf_value(world_to_object.transform_point(origin), world_to_object.transform_vector(direction)) };
+        return pdf > 0.f ? pdf * world_to_object.solid_angle_jacobian(direction) : 0.f;
+    }
+
+    vec3 random(const point3& origin) const override {
+        return object_to_world.transform_vector(blas->random(world_to_object.transform_point(origin)));
+    }
+
+    bool sample_light(const point3& origin, light_sample& sample) const override {
+        if (!blas->sample_light(world_to_object.transform_point(origin), sample))
+            return false;
+
+        sample.direction = object_to_world.transform_vector(sample.direction);
+        sample.distance = sample.direction.length();
+
+        const float jacobian{ world_to_object.solid_angle_jacobian(sample.direction) };
+        sample.pdf *= jacobian;
+        sample.emitter_pdf *= jacobian;
+        return true;
+    }
+
+    const affine3& transform() const { return object_to_world; }
+    const std::shared_ptr<entity>& object() const { return blas; }
+};
+#pragma endregion
+
+#pragma region translation/rotation object dec
+// Kept as named entities for the scenes, both are plain instances and fold into whatever they wrap or get wrapped by
+class translate final : public instance {
+public:
+    translate(std::shared_ptr<entity> object, const vec3& offset)
+        : instance(std::move(object), affine3::translation(offset)) {}
+};
+
+class rotate_y final : public instance {
+public:
+    rotate_y(std::shared_ptr<entity> object, float angle)
+        : instance(std::move(object), affine3::rotation_y(angle)) {}
+};
+#pragma endregion
+
+#pragma region instance definition
+// Exact types only, a user subclass of instance may override intersect and must stay a separate level
+inline bool is_plain_instance(const entity& ent) {
+    return typeid(ent) == typeid(instance) || typeid(ent) == typeid(translate) || typeid(ent) == typeid(rotate_y);
+}
+
+instance::instance(std::shared_ptr<entity> object, const affine3& transform)
+    : blas{ std::move(object) }
+    , object_to_world{ transform }
+{
+    if (is_plain_instance(*blas)) {
+        // Copy first, the inner instance may only be kept alive by blas
+        const std::shared_ptr<entity> inner_owner{ blas };
+        const auto& inner{ static_cast<const instance&>(*inner_owner) };
+        object_to_world = transform * inner.object_to_world;
+        blas = inner.blas;
+    }
+
+    world_to_object = object_to_world.inverse();
+    bbox = object_to_world.transform_box(blas->bounding_box());
+}
+#pragma endregion
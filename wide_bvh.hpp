@@ -0,0 +1,582 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "entity.hpp"
+#include "entitylist.hpp"
+#include "primitive.hpp"
+#include "primitive_block.hpp"
+#include "ray.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <immintrin.h>
+#include <vector>
+
+#pragma region 4 wide BVH node
+// Four child boxes in SoA layout so one SSE slab test covers all of them, 128 bytes (two cache lines).
+// A child with leaf_count > 0 is a leaf and child[i] indexes bvh4::leaves, otherwise child[i] is a node index.
+struct alignas(16) bvh4_node {
+    float min_x[4];
+    float min_y[4];
+    float min_z[4];
+    float max_x[4];
+    float max_y[4];
+    float max_z[4];
+    uint32_t child[4];
+    uint16_t leaf_count[4];
+    uint32_t child_count;
+};
+static_assert(sizeof(bvh4_node) == 128, "bvh4_node should stay 128 bytes");
+
+// Change of each child box from shutter open to close, parallel to bvh4::nodes and only kept when something moves.
+// The node itself holds the bounds at shutter open, traversal interpolates them by the ray time.
+struct alignas(16) bvh4_node_motion {
+    float min_x[4];
+    float min_y[4];
+    float min_z[4];
+    float max_x[4];
+    float max_y[4];
+    float max_z[4];
+};
+
+// Primitives of one leaf sorted by kind: spheres and quads packed four to a SIMD block, the rest tested one by one
+struct bvh4_leaf {
+    uint32_t sphere_begin{};
+    uint32_t quad_begin{};
+    uint32_t other_begin{};
+    uint16_t sphere_count{};
+    uint16_t quad_count{};
+    uint16_t other_count{};
+};
+#pragma endregion
+
+#pragma region 4 wide BVH decl
+// QBVH: builds the binary bvh_node with the requested options and collapses every two levels into one 4 wide node.
+// Selectable in place of bvh_node wherever an entity is expected.
+class bvh4 : public entity {
+
+    std::vector<bvh4_node> nodes;
+    std::vector<primitive> primitives; // leaf order of the binary tree, sorted by kind within each leaf
+    std::vector<bvh4_leaf> leaves;
+    std::vector<sphere_block> sphere_blocks;
+    std::vector<quad_block> quad_blocks;
+    std::vector<bvh4_node_motion> motion;
+    std::vector<bvh4_node> swept_nodes; // the binary tree's boxes, kept with motion for rays timed outside the shutter
+    float shutter_open{};
+    float shutter_close{};
+    float inv_shutter_length{};
+    aabb bbox;
+
+    static constexpr int max_traversal_stack{ 256 };
+    // Each wide level pops one entry and pushes up to four, a node at depth d leaves at most 3 * d + 1 on the stack
+    static constexpr int max_wide_depth{ (max_traversal_stack - 1) / 3 };
+    static constexpr size_t simd_width{ 4 };
+
+    struct stack_entry {
+        uint32_t child;
+        uint32_t leaf_count;
+        float t_entry;
+    };
+
+    static bool is_leaf(const linear_bvh_node& node) { return node.primitive_count > 0; }
+
+    static void set_child_box(bvh4_node& node, int slot, const aabb& box) {
+        node.min_x[slot] = box.x.min;
+        node.min_y[slot] = box.y.min;
+        node.min_z[slot] = box.z.min;
+        node.max_x[slot] = box.x.max;
+        node.max_y[slot] = box.y.max;
+        node.max_z[slot] = box.z.max;
+    }
+
+    // Turns the binary interior node at binary_index into a wide node, returns the wide node index.
+    // Every wide level consumes at least one binary level, so the binary tree's 64 levels bound depth.
+    uint32_t collapse(const std::vector<linear_bvh_node>& binary, uint32_t binary_index, int depth) {
+        assert(depth < max_wide_depth);
+        std::array<uint32_t, 4> slots{ binary_index + 1, binary[binary_index].offset, 0, 0 };
+        uint32_t slot_count{ 2 };
+
+        // Open the interior child with the largest surface area until all four lanes are used
+        while (slot_count < 4) {
+            int widest{ -1 };
+            float widest_area{ -1.f };
+            for (uint32_t i{ 0 }; i < slot_count; ++i) {
+                const linear_bvh_node& candidate{ binary[slots[i]] };
+                if (!is_leaf(candidate) && candidate.bbox.surface_area() > widest_area) {
+                    widest = static_cast<int>(i);
+                    widest_area = candidate.bbox.surface_area();
+                }
+            }
+
+            if (widest < 0)
+                break;
+
+            const uint32_t opened{ slots[widest] };
+            slots[widest] = opened + 1;
+            slots[slot_count++] = binary[opened].offset;
+        }
+
+        const auto wide_index{ static_cast<uint32_t>(nodes.size()) };
+        nodes.emplace_back();
+        nodes[wide_index].child_count = slot_count;
+
+        for (uint32_t i{ 0 }; i < 4; ++i) {
+            if (i >= slot_count) {
+                set_child_box(nodes[wide_index], i, aabb::empty);
+                nodes[wide_index].child[i] = 0;
+                nodes[wide_index].leaf_count[i] = 0;
+                continue;
+            }
+
+            const linear_bvh_node& child{ binary[slots[i]] };
+            set_child_box(nodes[wide_index], i, child.bbox);
+
+            if (is_leaf(child)) {
+                nodes[wide_index].child[i] = child.offset;
+                nodes[wide_index].leaf_count[i] = child.primitive_count;
+            } else {
+                // nodes may be reallocated by the recursion, index instead of holding a reference
+                uint32_t wide_child{ collapse(binary, slots[i], depth + 1) };
+                nodes[wide_index].child[i] = wide_child;
+                nodes[wide_index].leaf_count[i] = 0;
+            }
+        }
+
+        return wide_index;
+    }
+
+    // Motion bounds only hold for the shutter they were built for, outside it the boxes would be extrapolated
+    // past anything they were fitted to and the swept boxes have to be used instead
+    bool in_shutter(float time) const { return time >= shutter_open && time <= shutter_close; }
+
+    aabb lane_box(uint32_t node_index, int lane, float shutter_fraction) const {
+        const bvh4_node& node{ nodes[node_index] };
+        const bvh4_node_motion& delta{ motion[node_index] };
+        return aabb{
+            point3(node.min_x[lane] + shutter_fraction * delta.min_x[lane],
+                   node.min_y[lane] + shutter_fraction * delta.min_y[lane],
+                   node.min_z[lane] + shutter_fraction * delta.min_z[lane]),
+            point3(node.max_x[lane] + shutter_fraction * delta.max_x[lane],
+                   node.max_y[lane] + shutter_fraction * delta.max_y[lane],
+                   node.max_z[lane] + shutter_fraction * delta.max_z[lane])
+        };
+    }
+
+    // Replaces the swept child boxes by the boxes at shutter open plus their change until close. Wide children
+    // are always created after their parent, so walking the nodes backwards finishes every child before its lane.
+    // Leaf lanes must still hold the binary (first primitive, count).
+    // Interpolating costs a second set of loads per node, so the swept boxes are kept unless the boxes at mid
+    // shutter are clearly smaller, which needs motion of about the size of the primitives.
+    bool build_motion_bounds(const interval& shutter) {
+        swept_nodes = nodes;
+        motion.assign(nodes.size(), bvh4_node_motion{});
+        std::vector<std::array<aabb, 4>> close_boxes(nodes.size());
+
+        for (size_t index{ nodes.size() }; index-- > 0;) {
+            bvh4_node& node{ nodes[index] };
+            for (uint32_t lane{ 0 }; lane < node.child_count; ++lane) {
+                aabb open_box{ aabb::empty };
+                aabb close_box{ aabb::empty };
+
+                if (node.leaf_count[lane] > 0) {
+                    for (uint32_t i{ node.child[lane] }; i < node.child[lane] + node.leaf_count[lane]; ++i) {
+                        open_box = aabb(open_box, primitive_bounds_at(primitives[i], shutter.min));
+                        close_box = aabb(close_box, primitive_bounds_at(primitives[i], shutter.max));
+                    }
+                } else {
+                    const bvh4_node& child{ nodes[node.child[lane]] };
+                    for (uint32_t child_lane{ 0 }; child_lane < child.child_count; ++child_lane) {
+                        open_box = aabb(open_box, aabb{
+                            point3(child.min_x[child_lane], child.min_y[child_lane], child.min_z[child_lane]),
+                            point3(child.max_x[child_lane], child.max_y[child_lane], child.max_z[child_lane]) });
+                        close_box = aabb(close_box, close_boxes[node.child[lane]][child_lane]);
+                    }
+                }
+
+                set_child_box(node, lane, open_box);
+                close_boxes[index][lane] = close_box;
+
+                bvh4_node_motion& delta{ motion[index] };
+                delta.min_x[lane] = close_box.x.min - open_box.x.min;
+                delta.min_y[lane] = close_box.y.min - open_box.y.min;
+                delta.min_z[lane] = close_box.z.min - open_box.z.min;
+                delta.max_x[lane] = close_box.x.max - open_box.x.max;
+                delta.max_y[lane] = close_box.y.max - open_box.y.max;
+                delta.max_z[lane] = close_box.z.max - open_box.z.max;
+            }
+        }
+
+        shutter_open = shutter.min;
+        shutter_close = shutter.max;
+        inv_shutter_length = shutter.size() > 0.f ? 1.f / shutter.size() : 0.f;
+
+        float swept_area{ 0.f };
+        float mid_shutter_area{ 0.f };
+        for (uint32_t index{ 0 }; index < nodes.size(); ++index) {
+            for (uint32_t lane{ 0 }; lane < nodes[index].child_count; ++lane) {
+                const bvh4_node& swept{ swept_nodes[index] };
+                swept_area += aabb{ point3(swept.min_x[lane], swept.min_y[lane], swept.min_z[lane]),
+                                    point3(swept.max_x[lane], swept.max_y[lane], swept.max_z[lane]) }.surface_area();
+                mid_shutter_area += lane_box(index, lane, 0.5f).surface_area();
+            }
+        }
+
+        if (mid_shutter_area < 0.9f * swept_area)
+            return true;
+
+        nodes = std::move(swept_nodes);
+        swept_nodes.clear();
+        motion.clear();
+        return false;
+    }
+
+    static int block_kind(const primitive& prim) {
+        if (std::holds_alternative<sphere>(prim)) return 0;
+        if (std::holds_alternative<quad>(prim)) return 1;
+        return 2;
+    }
+
+    // Sorts the leaf's primitive range by kind and packs the spheres and quads into blocks, returns the leaf index
+    uint32_t make_leaf(uint32_t first, uint32_t count) {
+        const uint32_t end{ first + count };
+        std::stable_sort(primitives.begin() + first, primitives.begin() + end,
+            [](const primitive& a, const primitive& b) { return block_kind(a) < block_kind(b); });
+
+        bvh4_leaf leaf{};
+        leaf.sphere_begin = static_cast<uint32_t>(sphere_blocks.size());
+        leaf.quad_begin = static_cast<uint32_t>(quad_blocks.size());
+
+        uint32_t i{ first };
+        for (uint32_t packed{ 0 }; i < end && block_kind(primitives[i]) == 0; ++i, ++packed) {
+            if (packed % 4 == 0) {
+                sphere_blocks.emplace_back();
+                ++leaf.sphere_count;
+            }
+            sphere_blocks.back().add(std::get<sphere>(primitives[i]), i);
+        }
+
+        for (uint32_t packed{ 0 }; i < end && block_kind(primitives[i]) == 1; ++i, ++packed) {
+            if (packed % 4 == 0) {
+                quad_blocks.emplace_back();
+                ++leaf.quad_count;
+            }
+            quad_blocks.back().add(std::get<quad>(primitives[i]), i);
+        }
+
+        leaf.other_begin = i;
+        leaf.other_count = static_cast<uint16_t>(end - i);
+
+        leaves.push_back(leaf);
+        return static_cast<uint32_t>(leaves.size() - 1);
+    }
+
+    bool hit_leaf(const bvh4_leaf& leaf, const ray& r, interval& ray_t, hit_record& rec) const {
+        bool hit_anything{ false };
+        float t;
+
+        // Only leaves with blocks pay for broadcasting the ray
+        const simd_ray block_r{ leaf.sphere_count + leaf.quad_count > 0 ? simd_ray{ r } : simd_ray{} };
+
+        for (uint32_t i{ 0 }; i < leaf.sphere_count; ++i) {
+            const sphere_block& block{ sphere_blocks[leaf.sphere_begin + i] };
+            const int lane{ block.intersect(block_r, ray_t, t) };
+            if (lane >= 0) {
+                rec.t = t;
+                rec.object = &std::get<sphere>(primitives[block.primitive[lane]]);
+                ray_t.max = t;
+                hit_anything = true;
+            }
+        }
+
+        for (uint32_t i{ 0 }; i < leaf.quad_count; ++i) {
+            const quad_block& block{ quad_blocks[leaf.quad_begin + i] };
+            float alpha, beta;
+            const int lane{ block.intersect(block_r, ray_t, t, alpha, beta) };
+            if (lane >= 0) {
+                rec.t = t;
+                rec.u = alpha;
+                rec.v = beta;
+                rec.object = &std::get<quad>(primitives[block.primitive[lane]]);
+                ray_t.max = t;
+                hit_anything = true;
+            }
+        }
+
+        for (uint32_t i{ 0 }; i < leaf.other_count; ++i) {
+            if (intersect_primitive(primitives[leaf.other_begin + i], r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    bool occluded_leaf(const bvh4_leaf& leaf, const ray& r, const interval& ray_t) const {
+        float t;
+        const simd_ray block_r{ leaf.sphere_count + leaf.quad_count > 0 ? simd_ray{ r } : simd_ray{} };
+
+        for (uint32_t i{ 0 }; i < leaf.sphere_count; ++i) {
+            if (sphere_blocks[leaf.sphere_begin + i].intersect(block_r, ray_t, t) >= 0)
+                return true;
+        }
+
+        for (uint32_t i{ 0 }; i < leaf.quad_count; ++i) {
+            float alpha, beta;
+            if (quad_blocks[leaf.quad_begin + i].intersect(block_r, ray_t, t, alpha, beta) >= 0)
+                return true;
+        }
+
+        for (uint32_t i{ 0 }; i < leaf.other_count; ++i) {
+            if (occluded_primitive(primitives[leaf.other_begin + i], r, ray_t))
+                return true;
+        }
+
+        return false;
+    }
+
+public:
+
+    // Leaves test spheres and quads four at a time, when they make up most of the list the SAH is told to fill them.
+    // Other primitives (instances of a TLAS for example) are still tested one by one and keep small leaves.
+    bvh4(entity_list list, bvh_build_options build_options = {}) {
+        const auto batchable{ std::count_if(list.entities.begin(), list.entities.end(), [](const auto& ent) {
+            return typeid(*ent) == typeid(sphere) || typeid(*ent) == typeid(quad);
+        }) };
+        if (2 * static_cast<size_t>(batchable) > list.entities.size())
+            build_options.leaf_batch_width = simd_width;
+
+        bvh_node binary{ std::move(list), build_options };
+        const auto& binary_nodes{ binary.linear_nodes() };
+        primitives = binary.ordered_primitives();
+        bbox = binary.bounding_box();
+
+        if (binary_nodes.empty())
+            return;
+
+        if (is_leaf(binary_nodes[0])) {
+            // Tiny scene, a single root lane pointing at the only leaf
+            nodes.emplace_back();
+            for (int i{ 0 }; i < 4; ++i)
+                set_child_box(nodes[0], i, aabb::empty);
+            set_child_box(nodes[0], 0, binary_nodes[0].bbox);
+            nodes[0].child[0] = binary_nodes[0].offset;
+            nodes[0].leaf_count[0] = binary_nodes[0].primitive_count;
+            nodes[0].child_count = 1;
+        } else {
+            nodes.reserve(binary_nodes.size() / 2 + 1);
+            collapse(binary_nodes, 0, 0);
+            nodes.shrink_to_fit();
+        }
+
+        build_motion_bounds(build_options.shutter);
+
+        // Leaf lanes still hold the binary (first primitive, count), swap them for packed leaves
+        for (size_t index{ 0 }; index < nodes.size(); ++index) {
+            bvh4_node& node{ nodes[index] };
+            for (uint32_t lane{ 0 }; lane < node.child_count; ++lane) {
+                if (node.leaf_count[lane] == 0)
+                    continue;
+
+                node.child[lane] = make_leaf(node.child[lane], node.leaf_count[lane]);
+                if (!swept_nodes.empty())
+                    swept_nodes[index].child[lane] = node.child[lane];
+            }
+        }
+
+        if (build_options.print_stats)
+            std::clog << "BVH4 collapsed: " << binary_nodes.size() << " binary nodes into " << nodes.size()
+                << " wide nodes, " << sphere_blocks.size() << " sphere and " << quad_blocks.size() << " quad blocks"
+                << (motion.empty() ? "" : ", motion bounds") << "\n";
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty())
+            return false;
+
+        if (motion.empty())
+            return traverse<false>(nodes, r, ray_t, rec);
+        return in_shutter(static_cast<float>(r.time())) ? traverse<true>(nodes, r, ray_t, rec) : traverse<false>(swept_nodes, r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (nodes.empty())
+            return false;
+
+        if (motion.empty())
+            return traverse_occluded<false>(nodes, r, ray_t);
+        return in_shutter(static_cast<float>(r.time())) ? traverse_occluded<true>(nodes, r, ray_t) : traverse_occluded<false>(swept_nodes, r, ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void collect_emitters(const affine3& object_to_world, std::vector<emitter>& emitters) const override {
+        for (const primitive& prim : primitives)
+            collect_primitive_emitters(prim, object_to_world, emitters);
+    }
+
+    aabb bounding_box_at(float time) const override {
+        if (motion.empty() || !in_shutter(time))
+            return bbox;
+
+        const float shutter_fraction{ (time - shutter_open) * inv_shutter_length };
+        aabb box{ aabb::empty };
+        for (uint32_t lane{ 0 }; lane < nodes[0].child_count; ++lane)
+            box = aabb(box, lane_box(0, lane, shutter_fraction));
+        return box;
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+private:
+
+    // Ray broadcast for the node slab tests
+    struct wide_ray {
+        __m128 origin_x, origin_y, origin_z;
+        __m128 inv_dir_x, inv_dir_y, inv_dir_z;
+        __m128 shutter_fraction;
+
+        wide_ray(const ray& r, float shutter_open, float inv_shutter_length) {
+            const traversal_ray tr{ r };
+            origin_x = _mm_set1_ps(tr.origin.x());
+            origin_y = _mm_set1_ps(tr.origin.y());
+            origin_z = _mm_set1_ps(tr.origin.z());
+            inv_dir_x = _mm_set1_ps(tr.inv_dir.x());
+            inv_dir_y = _mm_set1_ps(tr.inv_dir.y());
+            inv_dir_z = _mm_set1_ps(tr.inv_dir.z());
+            shutter_fraction = _mm_set1_ps((static_cast<float>(r.time()) - shutter_open) * inv_shutter_length);
+        }
+    };
+
+    // Slab test of the node's four children, returns the mask of lanes hit inside ray_t and their entry distances.
+    // tree is nodes, or swept_nodes for a ray outside the shutter, both share the layout.
+    template <bool moving>
+    __forceinline int hit_lanes(const std::vector<bvh4_node>& tree, uint32_t node_index, const wide_ray& wr
+        , const interval& ray_t, __m128& t_near) const {
+        const bvh4_node& node{ tree[node_index] };
+
+        __m128 min_x{ _mm_load_ps(node.min_x) };
+        __m128 max_x{ _mm_load_ps(node.max_x) };
+        __m128 min_y{ _mm_load_ps(node.min_y) };
+        __m128 max_y{ _mm_load_ps(node.max_y) };
+        __m128 min_z{ _mm_load_ps(node.min_z) };
+        __m128 max_z{ _mm_load_ps(node.max_z) };
+
+        if constexpr (moving) {
+            const bvh4_node_motion& delta{ motion[node_index] };
+            min_x = _mm_add_ps(min_x, _mm_mul_ps(wr.shutter_fraction, _mm_load_ps(delta.min_x)));
+            max_x = _mm_add_ps(max_x, _mm_mul_ps(wr.shutter_fraction, _mm_load_ps(delta.max_x)));
+            min_y = _mm_add_ps(min_y, _mm_mul_ps(wr.shutter_fraction, _mm_load_ps(delta.min_y)));
+            max_y = _mm_add_ps(max_y, _mm_mul_ps(wr.shutter_fraction, _mm_load_ps(delta.max_y)));
+            min_z = _mm_add_ps(min_z, _mm_mul_ps(wr.shutter_fraction, _mm_load_ps(delta.min_z)));
+            max_z = _mm_add_ps(max_z, _mm_mul_ps(wr.shutter_fraction, _mm_load_ps(delta.max_z)));
+        }
+
+        const __m128 t0_x{ _mm_mul_ps(_mm_sub_ps(min_x, wr.origin_x), wr.inv_dir_x) };
+        const __m128 t1_x{ _mm_mul_ps(_mm_sub_ps(max_x, wr.origin_x), wr.inv_dir_x) };
+        const __m128 t0_y{ _mm_mul_ps(_mm_sub_ps(min_y, wr.origin_y), wr.inv_dir_y) };
+        const __m128 t1_y{ _mm_mul_ps(_mm_sub_ps(max_y, wr.origin_y), wr.inv_dir_y) };
+        const __m128 t0_z{ _mm_mul_ps(_mm_sub_ps(min_z, wr.origin_z), wr.inv_dir_z) };
+        const __m128 t1_z{ _mm_mul_ps(_mm_sub_ps(max_z, wr.origin_z), wr.inv_dir_z) };
+
+        t_near = _mm_max_ps(_mm_min_ps(t0_x, t1_x), _mm_min_ps(t0_y, t1_y));
+        t_near = _mm_max_ps(_mm_max_ps(t_near, _mm_min_ps(t0_z, t1_z)), _mm_set1_ps(ray_t.min));
+
+        __m128 t_far{ _mm_min_ps(_mm_max_ps(t0_x, t1_x), _mm_max_ps(t0_y, t1_y)) };
+        t_far = _mm_min_ps(_mm_min_ps(t_far, _mm_max_ps(t0_z, t1_z)), _mm_set1_ps(ray_t.max));
+
+        return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) & ((1 << node.child_count) - 1);
+    }
+
+    template <bool moving>
+    bool traverse(const std::vector<bvh4_node>& tree, const ray& r, interval ray_t, hit_record& rec) const {
+        const wide_ray wr{ r, shutter_open, inv_shutter_length };
+
+        stack_entry to_visit[max_traversal_stack];
+        int to_visit_count{ 0 };
+        to_visit[to_visit_count++] = stack_entry{ 0, 0, ray_t.min };
+
+        bool hit_anything{ false };
+
+        while (to_visit_count > 0) {
+            const stack_entry entry{ to_visit[--to_visit_count] };
+
+            // Closer hit found since this entry was pushed
+            if (entry.t_entry > ray_t.max)
+                continue;
+
+            if (entry.leaf_count > 0) {
+                hit_anything |= hit_leaf(leaves[entry.child], r, ray_t, rec);
+                continue;
+            }
+
+            __m128 t_near;
+            const int hit_mask{ hit_lanes<moving>(tree, entry.child, wr, ray_t, t_near) };
+            if (hit_mask == 0)
+                continue;
+
+            const bvh4_node& node{ tree[entry.child] };
+            alignas(16) float t_entry[4];
+            _mm_store_ps(t_entry, t_near);
+
+            // Sort the hit lanes near to far, then push them far first so the nearest is popped next
+            int order[4];
+            int order_count{ 0 };
+            for (int lane{ 0 }; lane < 4; ++lane) {
+                if (!(hit_mask & (1 << lane)))
+                    continue;
+
+                int insert_at{ order_count++ };
+                while (insert_at > 0 && t_entry[order[insert_at - 1]] > t_entry[lane]) {
+                    order[insert_at] = order[insert_at - 1];
+                    --insert_at;
+                }
+                order[insert_at] = lane;
+            }
+
+            assert(to_visit_count + order_count <= max_traversal_stack);
+            for (int i{ order_count - 1 }; i >= 0; --i) {
+                const int lane{ order[i] };
+                to_visit[to_visit_count++] = stack_entry{ node.child[lane], node.leaf_count[lane], t_entry[lane] };
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // Any hit ends the walk, so lanes are pushed as they come without sorting and ray_t never shrinks
+    template <bool moving>
+    bool traverse_occluded(const std::vector<bvh4_node>& tree, const ray& r, interval ray_t) const {
+        const wide_ray wr{ r, shutter_open, inv_shutter_length };
+
+        stack_entry to_visit[max_traversal_stack];
+        int to_visit_count{ 0 };
+        to_visit[to_visit_count++] = stack_entry{ 0, 0, ray_t.min };
+
+        while (to_visit_count > 0) {
+            const stack_entry entry{ to_visit[--to_visit_count] };
+
+            if (entry.leaf_count > 0) {
+                if (occluded_leaf(leaves[entry.child], r, ray_t))
+                    return true;
+                continue;
+            }
+
+            __m128 t_near;
+            const int hit_mask{ hit_lanes<moving>(tree, entry.child, wr, ray_t, t_near) };
+            const bvh4_node& node{ tree[entry.child] };
+
+            assert(to_visit_count + 4 <= max_traversal_stack);
+            for (int lane{ 0 }; lane < 4; ++lane) {
+                if (hit_mask & (1 << lane))
+                    to_visit[to_visit_count++] = stack_entry{ node.child[lane], node.leaf_count[lane], 0.f };
+            }
+        }
+
+        return false;
+    }
+};
+#pragma endregion